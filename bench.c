@@ -0,0 +1,677 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nn_func.h"
+#include "nn_histogram.h"
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint64_t now_nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void fill_uniform(double *values, size_t count, double low, double high) {
+    size_t i;
+    for (i = 0; i < count; i++) {
+        values[i] = low + (high - low) * ((double)rand() / (double)RAND_MAX);
+    }
+}
+
+static void bench_dense(void) {
+    size_t sizes[4] = {64, 256, 256, 16};
+    struct dense_layer layers[3];
+    double *weights[3];
+    double *biases[3];
+    double *input;
+    double *output;
+    double *scratch;
+    size_t batch_sizes[3] = {1, 32, 256};
+    size_t layer_count;
+    size_t b;
+    size_t i;
+    int iterations;
+    int iteration;
+    double start;
+    double elapsed;
+
+    layer_count = 3;
+    for (i = 0; i < layer_count; i++) {
+        weights[i] = malloc(sizes[i] * sizes[i + 1] * sizeof(double));
+        biases[i] = malloc(sizes[i + 1] * sizeof(double));
+        fill_uniform(weights[i], sizes[i] * sizes[i + 1], -0.1, 0.1);
+        fill_uniform(biases[i], sizes[i + 1], -0.1, 0.1);
+        layers[i].weights = weights[i];
+        layers[i].bias = biases[i];
+        layers[i].input_size = sizes[i];
+        layers[i].output_size = sizes[i + 1];
+        layers[i].activation = i == layer_count - 1 ? sigmoid : relu;
+    }
+
+    for (b = 0; b < 3; b++) {
+        input = malloc(batch_sizes[b] * sizes[0] * sizeof(double));
+        output = malloc(batch_sizes[b] * sizes[layer_count] * sizeof(double));
+        scratch = malloc(mlp_scratch_length(layers, layer_count, batch_sizes[b]) * sizeof(double));
+        fill_uniform(input, batch_sizes[b] * sizes[0], -1.0, 1.0);
+
+        iterations = (int)(20000 / batch_sizes[b]) + 10;
+        mlp_forward(layers, layer_count, input, output, batch_sizes[b], scratch);
+        start = now_seconds();
+        for (iteration = 0; iteration < iterations; iteration++) {
+            mlp_forward(layers, layer_count, input, output, batch_sizes[b], scratch);
+        }
+        elapsed = now_seconds() - start;
+        printf("dense mlp 64-256-256-16 batch %4zu: %9.2f us/call %12.0f samples/s\n",
+               batch_sizes[b], elapsed / iterations * 1e6,
+               (double)batch_sizes[b] * iterations / elapsed);
+
+        free(input);
+        free(output);
+        free(scratch);
+    }
+
+    for (i = 0; i < layer_count; i++) {
+        free(weights[i]);
+        free(biases[i]);
+    }
+}
+
+static void bench_train(void) {
+    size_t sample_count = 8192;
+    size_t input_size = 16;
+    size_t hidden_size = 64;
+    size_t batch_size = 64;
+    size_t parameter_counts[4];
+    double *parameters[4];
+    double *gradients[4];
+    double *first_moments[4];
+    double *second_moments[4];
+    double *inputs;
+    double *targets;
+    double *true_weights;
+    double *hidden_pre;
+    double *hidden;
+    double *output_pre;
+    double *output;
+    double *output_grad;
+    double *hidden_grad;
+    double loss;
+    double error;
+    double start;
+    double elapsed;
+    size_t batch_start;
+    size_t i;
+    size_t k;
+    int epoch;
+    int step;
+
+    parameter_counts[0] = input_size * hidden_size;
+    parameter_counts[1] = hidden_size;
+    parameter_counts[2] = hidden_size;
+    parameter_counts[3] = 1;
+    for (i = 0; i < 4; i++) {
+        parameters[i] = malloc(parameter_counts[i] * sizeof(double));
+        gradients[i] = malloc(parameter_counts[i] * sizeof(double));
+        first_moments[i] = calloc(parameter_counts[i], sizeof(double));
+        second_moments[i] = calloc(parameter_counts[i], sizeof(double));
+        fill_uniform(parameters[i], parameter_counts[i], -0.2, 0.2);
+    }
+
+    inputs = malloc(sample_count * input_size * sizeof(double));
+    targets = malloc(sample_count * sizeof(double));
+    true_weights = malloc(input_size * sizeof(double));
+    fill_uniform(inputs, sample_count * input_size, -1.0, 1.0);
+    fill_uniform(true_weights, input_size, -1.0, 1.0);
+    for (i = 0; i < sample_count; i++) {
+        error = 0.0;
+        for (k = 0; k < input_size; k++) {
+            error = error + inputs[i * input_size + k] * true_weights[k];
+        }
+        targets[i] = sigmoid(2.0 * error * error - 1.0);
+    }
+
+    hidden_pre = malloc(batch_size * hidden_size * sizeof(double));
+    hidden = malloc(batch_size * hidden_size * sizeof(double));
+    hidden_grad = malloc(batch_size * hidden_size * sizeof(double));
+    output_pre = malloc(batch_size * sizeof(double));
+    output = malloc(batch_size * sizeof(double));
+    output_grad = malloc(batch_size * sizeof(double));
+
+    step = 0;
+    for (epoch = 1; epoch <= 5; epoch++) {
+        loss = 0.0;
+        start = now_seconds();
+        for (batch_start = 0; batch_start + batch_size <= sample_count; batch_start += batch_size) {
+            dense_forward(parameters[0], parameters[1], inputs + batch_start * input_size, hidden_pre,
+                          hidden, batch_size, input_size, hidden_size, relu);
+            dense_forward(parameters[2], parameters[3], hidden, output_pre, output, batch_size,
+                          hidden_size, 1, sigmoid);
+            for (i = 0; i < batch_size; i++) {
+                error = output[i] - targets[batch_start + i];
+                loss = loss + 0.5 * error * error;
+                output_grad[i] = error / (double)batch_size;
+            }
+            dense_backward(parameters[2], hidden, output_pre, output_grad, output_grad, gradients[2],
+                           gradients[3], hidden_grad, batch_size, hidden_size, 1, sigmoid_derivative);
+            dense_backward(parameters[0], inputs + batch_start * input_size, hidden_pre, hidden_grad,
+                           hidden_grad, gradients[0], gradients[1], NULL, batch_size, input_size,
+                           hidden_size, relu_derivative);
+            step++;
+            for (i = 0; i < 4; i++) {
+                adam_update(parameters[i], gradients[i], first_moments[i], second_moments[i],
+                            parameter_counts[i], step, 0.01, 0.9, 0.999, 1e-8);
+            }
+        }
+        elapsed = now_seconds() - start;
+        printf("train mlp 16-64-1 adam epoch %d: loss %.6f %12.0f samples/s\n", epoch,
+               loss / (double)sample_count, (double)sample_count / elapsed);
+    }
+
+    for (i = 0; i < 4; i++) {
+        free(parameters[i]);
+        free(gradients[i]);
+        free(first_moments[i]);
+        free(second_moments[i]);
+    }
+    free(inputs);
+    free(targets);
+    free(true_weights);
+    free(hidden_pre);
+    free(hidden);
+    free(hidden_grad);
+    free(output_pre);
+    free(output);
+    free(output_grad);
+}
+
+static void bench_parallel(void) {
+    size_t batch_size = 256;
+    size_t input_size = 256;
+    size_t output_size = 256;
+    struct thread_pool *pool;
+    enum gradient_reduction reductions[2] = {GRADIENT_REDUCTION_TREE, GRADIENT_REDUCTION_ATOMIC};
+    const char *reduction_names[2] = {"tree", "atomic"};
+    double *weights;
+    double *input;
+    double *pre_activation;
+    double *output_grad;
+    double *delta;
+    double *weight_grad;
+    double *bias_grad;
+    double *input_grad;
+    double baseline[2];
+    double start;
+    double elapsed;
+    long core_count;
+    int thread_count;
+    int iterations;
+    int iteration;
+    int r;
+
+    weights = malloc(input_size * output_size * sizeof(double));
+    input = malloc(batch_size * input_size * sizeof(double));
+    pre_activation = malloc(batch_size * output_size * sizeof(double));
+    output_grad = malloc(batch_size * output_size * sizeof(double));
+    delta = malloc(batch_size * output_size * sizeof(double));
+    weight_grad = malloc(input_size * output_size * sizeof(double));
+    bias_grad = malloc(output_size * sizeof(double));
+    input_grad = malloc(batch_size * input_size * sizeof(double));
+    fill_uniform(weights, input_size * output_size, -0.1, 0.1);
+    fill_uniform(input, batch_size * input_size, -1.0, 1.0);
+    fill_uniform(pre_activation, batch_size * output_size, -1.0, 1.0);
+    fill_uniform(output_grad, batch_size * output_size, -1.0, 1.0);
+
+    core_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (core_count < 1) {
+        core_count = 1;
+    }
+    iterations = 20;
+    thread_count = 1;
+    while (thread_count <= core_count) {
+        pool = thread_pool_create(thread_count);
+        for (r = 0; r < 2; r++) {
+            dense_backward_parallel(pool, reductions[r], weights, input, pre_activation, output_grad,
+                                    delta, weight_grad, bias_grad, input_grad, batch_size, input_size,
+                                    output_size, swish_derivative);
+            start = now_seconds();
+            for (iteration = 0; iteration < iterations; iteration++) {
+                dense_backward_parallel(pool, reductions[r], weights, input, pre_activation,
+                                        output_grad, delta, weight_grad, bias_grad, input_grad,
+                                        batch_size, input_size, output_size, swish_derivative);
+            }
+            elapsed = (now_seconds() - start) / iterations;
+            if (thread_count == 1) {
+                baseline[r] = elapsed;
+            }
+            printf("parallel backward 256x256 batch 256 %-6s threads %3d: %9.1f us/call speedup %.2fx\n",
+                   reduction_names[r], thread_count, elapsed * 1e6, baseline[r] / elapsed);
+        }
+        thread_pool_destroy(pool);
+        if (thread_count < core_count && thread_count * 2 > core_count) {
+            thread_count = (int)core_count;
+        } else {
+            thread_count = thread_count * 2;
+        }
+    }
+
+    free(weights);
+    free(input);
+    free(pre_activation);
+    free(output_grad);
+    free(delta);
+    free(weight_grad);
+    free(bias_grad);
+    free(input_grad);
+}
+
+/* sigmoid and elu of inputs below about -708 go through denormal values of
+   exp(); [-5, 0] is a reference range that stays normal. */
+static void bench_denormal(void) {
+    size_t array_length = 4096;
+    const char *range_names[2] = {"normal", "denormal"};
+    double range_lows[2] = {-5.0, -740.0};
+    double range_highs[2] = {0.0, -709.0};
+    double *input;
+    double *output;
+    double start;
+    double sigmoid_time;
+    double elu_time;
+    int iterations;
+    int iteration;
+    int range;
+    int flush;
+
+    input = malloc(array_length * sizeof(double));
+    output = malloc(array_length * sizeof(double));
+    iterations = 2000;
+    for (range = 0; range < 2; range++) {
+        fill_uniform(input, array_length, range_lows[range], range_highs[range]);
+        for (flush = 0; flush < 2; flush++) {
+            denormal_flush_set(flush);
+            sigmoid_array(input, output, array_length);
+            start = now_seconds();
+            for (iteration = 0; iteration < iterations; iteration++) {
+                sigmoid_array(input, output, array_length);
+            }
+            sigmoid_time = (now_seconds() - start) / ((double)iterations * array_length);
+            start = now_seconds();
+            for (iteration = 0; iteration < iterations; iteration++) {
+                elu_array(input, output, array_length, 1.0);
+            }
+            elu_time = (now_seconds() - start) / ((double)iterations * array_length);
+            printf("denormal %-8s inputs flush %-3s: sigmoid %6.2f ns/elem elu %6.2f ns/elem\n",
+                   range_names[range], flush ? "on" : "off", sigmoid_time * 1e9, elu_time * 1e9);
+        }
+    }
+    denormal_flush_set(0);
+
+    free(input);
+    free(output);
+}
+
+enum latency_kernel {
+    LATENCY_SIGMOID,
+    LATENCY_TANH,
+    LATENCY_RELU,
+    LATENCY_ELU,
+    LATENCY_SOFTMAX,
+    LATENCY_POOL_SIGMOID,
+    LATENCY_KERNEL_COUNT
+};
+
+static const char *latency_kernel_names[LATENCY_KERNEL_COUNT] = {
+    "sigmoid_array", "tanh_array", "relu_array", "elu_array", "softmax", "thread_pool_sigmoid_array",
+};
+
+struct pool_chunk {
+    const double *input;
+    double *output;
+    size_t length;
+};
+
+/* One client thread issuing calls back to back. The pool kernel splits each
+   call across the shared pool, so its latency includes waking the workers
+   and waiting for them, and contention on the pool when several clients
+   share it. */
+struct latency_client {
+    struct thread_pool *pool;
+    enum latency_kernel kernel;
+    size_t array_length;
+    int calls;
+    int started;
+    unsigned int seed;
+    struct histogram histogram;
+};
+
+static void pool_sigmoid_task(void *argument) {
+    struct pool_chunk *chunk = argument;
+
+    sigmoid_array(chunk->input, chunk->output, chunk->length);
+}
+
+static void *latency_client_run(void *argument) {
+    struct latency_client *client = argument;
+    struct pool_chunk *chunks;
+    void **task_arguments;
+    double *input;
+    double *output;
+    uint64_t start;
+    size_t offset;
+    int chunk_count;
+    int call;
+    int i;
+
+    input = malloc(client->array_length * sizeof(double));
+    output = malloc(client->array_length * sizeof(double));
+    chunk_count = thread_pool_size(client->pool);
+    chunks = malloc((size_t)chunk_count * sizeof(*chunks));
+    task_arguments = malloc((size_t)chunk_count * sizeof(*task_arguments));
+    for (offset = 0; offset < client->array_length; offset++) {
+        input[offset] = -4.0 + 8.0 * ((double)rand_r(&client->seed) / (double)RAND_MAX);
+    }
+    offset = 0;
+    for (i = 0; i < chunk_count; i++) {
+        chunks[i].input = input + offset;
+        chunks[i].output = output + offset;
+        chunks[i].length = client->array_length / chunk_count + ((size_t)i < client->array_length % chunk_count ? 1 : 0);
+        task_arguments[i] = &chunks[i];
+        offset += chunks[i].length;
+    }
+
+    for (call = 0; call < client->calls; call++) {
+        start = now_nanoseconds();
+        switch (client->kernel) {
+        case LATENCY_SIGMOID:
+            sigmoid_array(input, output, client->array_length);
+            break;
+        case LATENCY_TANH:
+            tanh_array(input, output, client->array_length);
+            break;
+        case LATENCY_RELU:
+            relu_array(input, output, client->array_length);
+            break;
+        case LATENCY_ELU:
+            elu_array(input, output, client->array_length, 1.0);
+            break;
+        case LATENCY_SOFTMAX:
+            softmax(input, output, client->array_length);
+            break;
+        default:
+            thread_pool_run(client->pool, pool_sigmoid_task, task_arguments, chunk_count);
+            break;
+        }
+        histogram_record(&client->histogram, now_nanoseconds() - start);
+    }
+
+    free(input);
+    free(output);
+    free(chunks);
+    free(task_arguments);
+    return NULL;
+}
+
+static void bench_latency(int concurrency, const char *json_path) {
+    size_t sizes[5] = {16, 64, 256, 1024, 4096};
+    struct histogram *total;
+    struct latency_client *clients;
+    struct thread_pool *pool;
+    pthread_t *threads;
+    FILE *json;
+    long core_count;
+    int kernel;
+    int first;
+    int b;
+    int i;
+
+    core_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (core_count < 1) {
+        core_count = 1;
+    }
+    pool = thread_pool_create((int)core_count);
+    clients = malloc((size_t)concurrency * sizeof(*clients));
+    threads = malloc((size_t)concurrency * sizeof(*threads));
+    total = malloc(sizeof(*total));
+    json = fopen(json_path, "w");
+    if (pool == NULL || clients == NULL || threads == NULL || total == NULL || json == NULL) {
+        fprintf(stderr, "latency: setup failed\n");
+        thread_pool_destroy(pool);
+        free(clients);
+        free(threads);
+        free(total);
+        if (json != NULL) {
+            fclose(json);
+        }
+        return;
+    }
+
+    fprintf(json, "{\"concurrency\":%d,\"pool_threads\":%d,\"results\":[", concurrency, thread_pool_size(pool));
+    first = 1;
+    for (kernel = 0; kernel < LATENCY_KERNEL_COUNT; kernel++) {
+        for (b = 0; b < 5; b++) {
+            memset(total, 0, sizeof(*total));
+            memset(clients, 0, (size_t)concurrency * sizeof(*clients));
+            for (i = 0; i < concurrency; i++) {
+                clients[i].pool = pool;
+                clients[i].kernel = (enum latency_kernel)kernel;
+                clients[i].array_length = sizes[b];
+                clients[i].calls = (int)(4000000 / (sizes[b] * (size_t)concurrency)) + 200;
+                if (clients[i].calls > 20000) {
+                    clients[i].calls = 20000;
+                }
+                clients[i].seed = (unsigned int)(i + 1);
+            }
+            for (i = 0; i < concurrency; i++) {
+                clients[i].started = pthread_create(&threads[i], NULL, latency_client_run, &clients[i]) == 0;
+                if (!clients[i].started) {
+                    latency_client_run(&clients[i]);
+                }
+            }
+            for (i = 0; i < concurrency; i++) {
+                if (clients[i].started) {
+                    pthread_join(threads[i], NULL);
+                }
+                histogram_merge(total, &clients[i].histogram);
+            }
+
+            printf("latency %-25s n %4zu clients %2d: p50 %8.2f p99 %8.2f p99.9 %8.2f max %9.2f us\n",
+                   latency_kernel_names[kernel], sizes[b], concurrency,
+                   histogram_percentile(total, 0.5) * 1e-3, histogram_percentile(total, 0.99) * 1e-3,
+                   histogram_percentile(total, 0.999) * 1e-3, total->max * 1e-3);
+            fprintf(json,
+                    "%s\n{\"kernel\":\"%s\",\"elements\":%zu,\"calls\":%llu,\"p50_ns\":%llu,"
+                    "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}",
+                    first ? "" : ",", latency_kernel_names[kernel], sizes[b],
+                    (unsigned long long)total->total,
+                    (unsigned long long)histogram_percentile(total, 0.5),
+                    (unsigned long long)histogram_percentile(total, 0.99),
+                    (unsigned long long)histogram_percentile(total, 0.999),
+                    (unsigned long long)total->max);
+            first = 0;
+        }
+    }
+    fprintf(json, "\n]}\n");
+    fclose(json);
+    printf("latency results written to %s\n", json_path);
+
+    thread_pool_destroy(pool);
+    free(clients);
+    free(threads);
+    free(total);
+}
+
+/* Many clients submitting small rows, called directly and through a
+   coalescer with a 50 us budget. */
+struct coalesce_bench_client {
+    struct coalescer *coalescer;
+    enum coalesce_kernel kernel;
+    size_t row_length;
+    int calls;
+    int started;
+    unsigned int seed;
+    struct histogram histogram;
+};
+
+static void *coalesce_bench_client_run(void *argument) {
+    struct coalesce_bench_client *client = argument;
+    double *input;
+    double *output;
+    uint64_t start;
+    size_t i;
+    int call;
+
+    input = malloc(client->row_length * sizeof(double));
+    output = malloc(client->row_length * sizeof(double));
+    for (i = 0; i < client->row_length; i++) {
+        input[i] = -4.0 + 8.0 * ((double)rand_r(&client->seed) / (double)RAND_MAX);
+    }
+    for (call = 0; call < client->calls; call++) {
+        start = now_nanoseconds();
+        if (client->coalescer != NULL) {
+            coalescer_submit(client->coalescer, input, output, client->row_length);
+        } else if (client->kernel == COALESCE_SOFTMAX) {
+            softmax(input, output, client->row_length);
+        } else {
+            sigmoid_array(input, output, client->row_length);
+        }
+        histogram_record(&client->histogram, now_nanoseconds() - start);
+    }
+    free(input);
+    free(output);
+    return NULL;
+}
+
+static void bench_coalesce(int concurrency) {
+    size_t row_lengths[3] = {64, 256, 512};
+    enum coalesce_kernel kernels[2] = {COALESCE_SIGMOID, COALESCE_SOFTMAX};
+    const char *kernel_names[2] = {"sigmoid", "softmax"};
+    struct coalesce_bench_client *clients;
+    struct coalescer_stats stats;
+    struct histogram *total;
+    struct coalescer *coalescer;
+    pthread_t *threads;
+    double start;
+    double elapsed;
+    int coalesced;
+    int k;
+    int b;
+    int i;
+
+    clients = malloc((size_t)concurrency * sizeof(*clients));
+    threads = malloc((size_t)concurrency * sizeof(*threads));
+    total = malloc(sizeof(*total));
+    if (clients == NULL || threads == NULL || total == NULL) {
+        fprintf(stderr, "coalesce: setup failed\n");
+        free(clients);
+        free(threads);
+        free(total);
+        return;
+    }
+    for (k = 0; k < 2; k++) {
+        for (b = 0; b < 3; b++) {
+            for (coalesced = 0; coalesced < 2; coalesced++) {
+                coalescer = coalesced ? coalescer_create(kernels[k], NULL, 16384, 50e-6) : NULL;
+                memset(total, 0, sizeof(*total));
+                memset(clients, 0, (size_t)concurrency * sizeof(*clients));
+                for (i = 0; i < concurrency; i++) {
+                    clients[i].coalescer = coalescer;
+                    clients[i].kernel = kernels[k];
+                    clients[i].row_length = row_lengths[b];
+                    clients[i].calls = (int)(2000000 / (row_lengths[b] * (size_t)concurrency)) + 100;
+                    clients[i].seed = (unsigned int)(i + 1);
+                }
+                start = now_seconds();
+                for (i = 0; i < concurrency; i++) {
+                    clients[i].started =
+                        pthread_create(&threads[i], NULL, coalesce_bench_client_run, &clients[i]) == 0;
+                    if (!clients[i].started) {
+                        coalesce_bench_client_run(&clients[i]);
+                    }
+                }
+                for (i = 0; i < concurrency; i++) {
+                    if (clients[i].started) {
+                        pthread_join(threads[i], NULL);
+                    }
+                    histogram_merge(total, &clients[i].histogram);
+                }
+                elapsed = now_seconds() - start;
+
+                printf("coalesce %-7s n %3zu clients %2d %-9s %9.0f rows/s  p50 %7.2f p99 %7.2f p99.9 %7.2f max %8.2f us",
+                       kernel_names[k], row_lengths[b], concurrency, coalesced ? "coalesced" : "direct",
+                       (double)total->total / elapsed, histogram_percentile(total, 0.5) * 1e-3,
+                       histogram_percentile(total, 0.99) * 1e-3, histogram_percentile(total, 0.999) * 1e-3,
+                       total->max * 1e-3);
+                if (coalescer != NULL) {
+                    coalescer_stats_get(coalescer, &stats);
+                    printf("  batch p50 %zu p99 %zu max %zu rows", stats.batch_submissions_p50,
+                           stats.batch_submissions_p99, stats.batch_submissions_max);
+                    coalescer_destroy(coalescer);
+                }
+                printf("\n");
+            }
+        }
+    }
+    free(clients);
+    free(threads);
+    free(total);
+}
+
+int main(int argc, char **argv) {
+    const char *trace_path;
+    const char *mode;
+    int concurrency;
+
+    mode = argc > 1 ? argv[1] : "all";
+    srand(1);
+    if (strcmp(mode, "latency") == 0) {
+        concurrency = argc > 2 ? atoi(argv[2]) : 1;
+        if (concurrency < 1) {
+            concurrency = 1;
+        }
+        bench_latency(concurrency, argc > 3 ? argv[3] : "latency.json");
+        return 0;
+    }
+    if (strcmp(mode, "coalesce") == 0) {
+        concurrency = argc > 2 ? atoi(argv[2]) : 4;
+        if (concurrency < 1) {
+            concurrency = 1;
+        }
+        bench_coalesce(concurrency);
+        return 0;
+    }
+    trace_path = argc > 2 ? argv[2] : NULL;
+    if (trace_path != NULL) {
+        trace_enable(1);
+    }
+    if (strcmp(mode, "dense") == 0 || strcmp(mode, "all") == 0) {
+        bench_dense();
+    }
+    if (strcmp(mode, "train") == 0 || strcmp(mode, "all") == 0) {
+        bench_train();
+    }
+    if (strcmp(mode, "parallel") == 0 || strcmp(mode, "all") == 0) {
+        bench_parallel();
+    }
+    if (strcmp(mode, "denormal") == 0 || strcmp(mode, "all") == 0) {
+        bench_denormal();
+    }
+    if (strcmp(mode, "all") == 0) {
+        bench_latency(1, "latency.json");
+    }
+    if (trace_path != NULL && trace_write_json(trace_path) != 0) {
+        fprintf(stderr, "could not write trace to %s (library built without TRACE=1?)\n", trace_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,370 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nn_func.h"
+#include "nn_linalg.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MAX_DEGREE 12
+#define MAX_SEGMENTS 4096
+#define GRID_POINTS 2048
+#define REMEZ_ITERATIONS 20
+#define TAIL_PROBE 1.0e6
+#define TAIL_WIDEN_STEPS 1024
+
+struct named_function {
+    const char *name;
+    activation_function function;
+};
+
+static double elu_unit(double input_value) {
+    return elu(input_value, 1.0);
+}
+
+static double elu_unit_derivative(double input_value) {
+    return elu_derivative(input_value, 1.0);
+}
+
+static const struct named_function functions[] = {
+    {"sigmoid", sigmoid},
+    {"sigmoid_derivative", sigmoid_derivative},
+    {"tanh", tanh_activation},
+    {"tanh_derivative", tanh_derivative},
+    {"elu", elu_unit},
+    {"elu_derivative", elu_unit_derivative},
+    {"swish", swish},
+    {"swish_derivative", swish_derivative},
+    {"softplus", softplus},
+    {"gelu", gelu},
+    {"gelu_derivative", gelu_derivative},
+};
+
+static double evaluate_polynomial(const double *coefficients, int degree, double t) {
+    double result;
+    int k;
+
+    result = coefficients[degree];
+    for (k = degree - 1; k >= 0; k--) {
+        result = result * t + coefficients[k];
+    }
+    return result;
+}
+
+/* Minimax polynomial in t = (2x - low - high) / (high - low) on one segment,
+   by the Remez exchange algorithm. Returns the maximum error on the grid. */
+static double remez_fit(activation_function target, double low, double high, int degree,
+                        double *coefficients) {
+    double reference[MAX_DEGREE + 2];
+    double matrix[(MAX_DEGREE + 2) * (MAX_DEGREE + 2)];
+    double rhs[MAX_DEGREE + 2];
+    double extrema[GRID_POINTS];
+    double extrema_error[GRID_POINTS];
+    double half_width;
+    double middle;
+    double t;
+    double error;
+    double power;
+    double max_error;
+    double best_error;
+    double run_best;
+    double run_best_t;
+    int extrema_count;
+    int unknowns;
+    int iteration;
+    int i;
+    int k;
+
+    half_width = 0.5 * (high - low);
+    middle = 0.5 * (high + low);
+    unknowns = degree + 2;
+    for (i = 0; i < unknowns; i++) {
+        reference[i] = -cos(M_PI * i / (unknowns - 1));
+    }
+
+    best_error = INFINITY;
+    for (iteration = 0; iteration < REMEZ_ITERATIONS; iteration++) {
+        for (i = 0; i < unknowns; i++) {
+            power = 1.0;
+            for (k = 0; k <= degree; k++) {
+                matrix[i * unknowns + k] = power;
+                power = power * reference[i];
+            }
+            matrix[i * unknowns + degree + 1] = i % 2 == 0 ? 1.0 : -1.0;
+            rhs[i] = target(middle + half_width * reference[i]);
+        }
+        if (solve_linear_system(matrix, rhs, unknowns) != 0) {
+            break;
+        }
+
+        extrema_count = 0;
+        max_error = 0.0;
+        run_best = 0.0;
+        run_best_t = -1.0;
+        for (i = 0; i < GRID_POINTS; i++) {
+            t = -1.0 + 2.0 * i / (GRID_POINTS - 1);
+            error = evaluate_polynomial(rhs, degree, t) - target(middle + half_width * t);
+            if (fabs(error) > max_error) {
+                max_error = fabs(error);
+            }
+            if (i > 0 && (error > 0.0) != (run_best > 0.0)) {
+                extrema[extrema_count] = run_best_t;
+                extrema_error[extrema_count] = run_best;
+                extrema_count++;
+                run_best = error;
+                run_best_t = t;
+            } else if (i == 0 || fabs(error) > fabs(run_best)) {
+                run_best = error;
+                run_best_t = t;
+            }
+        }
+        extrema[extrema_count] = run_best_t;
+        extrema_error[extrema_count] = run_best;
+        extrema_count++;
+
+        if (max_error < best_error) {
+            best_error = max_error;
+            memcpy(coefficients, rhs, (size_t)(degree + 1) * sizeof(double));
+        }
+        if (extrema_count < unknowns) {
+            break;
+        }
+        while (extrema_count > unknowns) {
+            if (fabs(extrema_error[0]) < fabs(extrema_error[extrema_count - 1])) {
+                memmove(extrema, extrema + 1, (size_t)(extrema_count - 1) * sizeof(double));
+                memmove(extrema_error, extrema_error + 1, (size_t)(extrema_count - 1) * sizeof(double));
+            }
+            extrema_count--;
+        }
+        memcpy(reference, extrema, (size_t)unknowns * sizeof(double));
+    }
+    return best_error;
+}
+
+/* Outside the fitted range the generated code returns the function's
+   asymptote, offset + slope * x, read off two probes far out on that side:
+   a constant for the saturating functions, x for the linear tails. */
+struct tail_line {
+    double offset;
+    double slope;
+};
+
+static struct tail_line tail_asymptote(activation_function target, double direction) {
+    struct tail_line line;
+    double near_value;
+    double far_value;
+
+    near_value = target(direction * TAIL_PROBE);
+    far_value = target(2.0 * direction * TAIL_PROBE);
+    line.slope = (far_value - near_value) / (direction * TAIL_PROBE);
+    line.offset = near_value - line.slope * direction * TAIL_PROBE;
+    return line;
+}
+
+/* Largest distance between the function and its asymptote from end outward,
+   sampled at steps that double up to TAIL_PROBE. */
+static double tail_error(activation_function target, struct tail_line line, double end, double direction) {
+    double step;
+    double probe;
+    double error;
+    double max_error;
+
+    max_error = fabs(target(end) - (line.offset + line.slope * end));
+    for (step = 1e-3; step <= TAIL_PROBE; step *= 2.0) {
+        probe = end + direction * step;
+        error = fabs(target(probe) - (line.offset + line.slope * probe));
+        if (!(error <= max_error)) {
+            max_error = error;
+        }
+    }
+    return max_error;
+}
+
+static void emit_tail(struct tail_line line) {
+    if (line.slope == 0.0) {
+        printf("        return %.17g;\n", line.offset + 0.0);
+    } else if (line.offset == 0.0 && line.slope == 1.0) {
+        printf("        return input_value;\n");
+    } else {
+        printf("        return %.17g + %.17g * input_value;\n", line.offset, line.slope);
+    }
+}
+
+static void emit_source(const char *name, double low, double high, int degree, int segments,
+                        const double *table, double max_error, double max_tail_error,
+                        struct tail_line low_tail, struct tail_line high_tail) {
+    int segment;
+    int k;
+
+    printf("/* Generated by gen_approx: %s on [%.17g, %.17g], %d segments of degree %d,\n", name, low,
+           high, segments, degree);
+    printf("   max abs error %.3g inside the range and %.3g on the asymptotes outside it. */\n\n",
+           max_error, max_tail_error);
+    printf("static const double %s_approx_table[%d][%d] = {\n", name, segments, degree + 1);
+    for (segment = 0; segment < segments; segment++) {
+        printf("    {");
+        for (k = 0; k <= degree; k++) {
+            printf("%s%.17g", k == 0 ? "" : ", ", table[segment * (degree + 1) + k]);
+        }
+        printf("},\n");
+    }
+    printf("};\n\n");
+
+    printf("static inline double %s_approx(double input_value) {\n", name);
+    printf("    const double *coefficients;\n");
+    printf("    double position;\n");
+    printf("    double t;\n");
+    printf("    double result;\n");
+    printf("    int segment;\n\n");
+    printf("    if (input_value <= %.17g) {\n", low);
+    emit_tail(low_tail);
+    printf("    }\n");
+    printf("    if (input_value >= %.17g) {\n", high);
+    emit_tail(high_tail);
+    printf("    }\n");
+    printf("    if (input_value != input_value) {\n");
+    printf("        return input_value;\n");
+    printf("    }\n");
+    printf("    position = (input_value - %.17g) * %.17g;\n", low, segments / (high - low));
+    printf("    segment = (int)position;\n");
+    printf("    if (segment > %d) {\n", segments - 1);
+    printf("        segment = %d;\n", segments - 1);
+    printf("    }\n");
+    printf("    t = 2.0 * (position - segment) - 1.0;\n");
+    printf("    coefficients = %s_approx_table[segment];\n", name);
+    printf("    result = coefficients[%d];\n", degree);
+    for (k = degree - 1; k >= 0; k--) {
+        printf("    result = result * t + coefficients[%d];\n", k);
+    }
+    printf("    return result;\n");
+    printf("}\n\n");
+
+    printf("static inline void %s_approx_array(const double *input_array, double *output_array, size_t array_length) {\n",
+           name);
+    printf("    size_t i;\n");
+    printf("    for (i = 0; i < array_length; i++) {\n");
+    printf("        output_array[i] = %s_approx(input_array[i]);\n", name);
+    printf("    }\n");
+    printf("}\n");
+}
+
+static void usage(const char *program) {
+    size_t i;
+
+    fprintf(stderr, "usage: %s function max_error low high [degree]\nfunctions:", program);
+    for (i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        fprintf(stderr, " %s", functions[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+    activation_function target;
+    struct tail_line low_tail;
+    struct tail_line high_tail;
+    double *table;
+    double target_error;
+    double low;
+    double high;
+    double width;
+    double error;
+    double max_error;
+    double requested_low;
+    double requested_high;
+    double low_tail_error;
+    double high_tail_error;
+    int low_steps;
+    int high_steps;
+    int first_segments;
+    int degree;
+    int segments;
+    int segment;
+    size_t i;
+
+    if (argc < 5) {
+        usage(argv[0]);
+        return 1;
+    }
+    target = NULL;
+    for (i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+        if (strcmp(argv[1], functions[i].name) == 0) {
+            target = functions[i].function;
+        }
+    }
+    target_error = atof(argv[2]);
+    low = atof(argv[3]);
+    high = atof(argv[4]);
+    degree = argc > 5 ? atoi(argv[5]) : 5;
+    if (target == NULL || !(target_error > 0.0) || !(high > low) || degree < 1 || degree > MAX_DEGREE) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* The range is widened in sixteenths of its width until the asymptotes
+       are within the target on both sides, so the bound holds for every x.
+       Segment counts then stay multiples of the sixteenths, which keeps the
+       original segment ends (and a kink at one of them) on the grid. */
+    low_tail = tail_asymptote(target, -1.0);
+    high_tail = tail_asymptote(target, 1.0);
+    width = (high - low) / 16.0;
+    requested_low = low;
+    requested_high = high;
+    low_steps = 0;
+    while (low_steps < TAIL_WIDEN_STEPS &&
+           !(tail_error(target, low_tail, requested_low - low_steps * width, -1.0) <= target_error)) {
+        low_steps++;
+    }
+    high_steps = 0;
+    while (high_steps < TAIL_WIDEN_STEPS &&
+           !(tail_error(target, high_tail, requested_high + high_steps * width, 1.0) <= target_error)) {
+        high_steps++;
+    }
+    low = requested_low - low_steps * width;
+    high = requested_high + high_steps * width;
+    low_tail_error = tail_error(target, low_tail, low, -1.0);
+    high_tail_error = tail_error(target, high_tail, high, 1.0);
+    if (!(low_tail_error <= target_error && high_tail_error <= target_error)) {
+        fprintf(stderr, "%s: no asymptote within %g outside [%g, %g]\n", argv[1], target_error, low, high);
+        return 1;
+    }
+    first_segments = 1;
+    if (low_steps + high_steps > 0) {
+        first_segments = 16 + low_steps + high_steps;
+        fprintf(stderr, "%s: range widened to [%.17g, %.17g] to keep the tails within %g\n", argv[1], low, high,
+                target_error);
+    }
+
+    table = malloc((size_t)MAX_SEGMENTS * (size_t)(degree + 1) * sizeof(double));
+    if (table == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (segments = first_segments; segments <= MAX_SEGMENTS; segments *= 2) {
+        width = (high - low) / segments;
+        max_error = 0.0;
+        for (segment = 0; segment < segments; segment++) {
+            error = remez_fit(target, low + width * segment, low + width * (segment + 1), degree,
+                              table + segment * (degree + 1));
+            if (error > max_error) {
+                max_error = error;
+            }
+            if (max_error > target_error) {
+                break;
+            }
+        }
+        if (max_error <= target_error) {
+            emit_source(argv[1], low, high, degree, segments, table, max_error,
+                        low_tail_error > high_tail_error ? low_tail_error : high_tail_error, low_tail, high_tail);
+            free(table);
+            return 0;
+        }
+    }
+    fprintf(stderr, "%s: error target %g not reached with %d segments of degree %d\n", argv[1],
+            target_error, MAX_SEGMENTS, degree);
+    free(table);
+    return 1;
+}
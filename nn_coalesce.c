@@ -0,0 +1,380 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nn_func.h"
+#include "nn_histogram.h"
+#include "nn_metrics.h"
+#include "nn_trace.h"
+
+/* Two batches let one fill while the other runs. A submitter that finds both
+   busy waits for one to finish. */
+#define COALESCE_BATCH_SLOTS 2
+#define COALESCE_MAX_REQUESTS 1024
+#define COALESCE_PARALLEL_ELEMENTS 16384
+#define COALESCE_PROBE_INTERVAL 16
+
+enum batch_state {
+    BATCH_FREE,
+    BATCH_OPEN,
+    BATCH_RUNNING
+};
+
+struct coalesce_request {
+    double *output;
+    size_t length;
+    size_t offset;
+};
+
+struct coalesce_chunk {
+    enum coalesce_kernel kernel;
+    const double *input;
+    double *output;
+    size_t length;
+};
+
+/* The first submitter into a free batch is its leader: it waits until the
+   deadline or until the batch fills, runs the kernel and scatters the
+   results. The others wait on done until generation moves on. */
+struct coalesce_batch {
+    struct coalesce_request requests[COALESCE_MAX_REQUESTS];
+    struct coalesce_chunk *chunks;
+    void **chunk_arguments;
+    double *input;
+    double *output;
+    size_t request_count;
+    size_t element_count;
+    struct timespec deadline;
+    uint64_t generation;
+    enum batch_state state;
+    int full;
+    int probe;
+    int denormal_flush;
+    pthread_cond_t wake_leader;
+    pthread_cond_t done;
+};
+
+struct coalescer {
+    pthread_mutex_t mutex;
+    pthread_cond_t slot_free;
+    struct coalesce_batch batches[COALESCE_BATCH_SLOTS];
+    struct coalesce_batch *open_batch;
+    struct thread_pool *pool;
+    enum coalesce_kernel kernel;
+    size_t max_batch_elements;
+    double budget_seconds;
+    size_t submitters;
+    size_t expected_batch_submissions;
+    uint64_t opened_batches;
+    struct histogram batch_submissions;
+    struct histogram batch_elements;
+    struct histogram latency;
+};
+
+static void coalesce_kernel_run(enum coalesce_kernel kernel, const double *input, double *output, size_t length) {
+    switch (kernel) {
+    case COALESCE_SIGMOID:
+        sigmoid_array(input, output, length);
+        break;
+    case COALESCE_TANH:
+        tanh_array(input, output, length);
+        break;
+    case COALESCE_RELU:
+        relu_array(input, output, length);
+        break;
+    case COALESCE_LEAKY_RELU:
+        leaky_relu_array(input, output, length);
+        break;
+    case COALESCE_HARD_SIGMOID:
+        hard_sigmoid_array(input, output, length);
+        break;
+    case COALESCE_SWISH:
+        swish_array(input, output, length);
+        break;
+    case COALESCE_SOFTMAX:
+        softmax(input, output, length);
+        break;
+    }
+}
+
+static void coalesce_chunk_task(void *argument) {
+    struct coalesce_chunk *chunk = argument;
+
+    coalesce_kernel_run(chunk->kernel, chunk->input, chunk->output, chunk->length);
+}
+
+static void coalesce_softmax_batch(struct coalesce_batch *batch) {
+    size_t row_length;
+    size_t i;
+
+    row_length = batch->requests[0].length;
+    for (i = 1; i < batch->request_count; i++) {
+        if (batch->requests[i].length != row_length) {
+            break;
+        }
+    }
+    if (i == batch->request_count) {
+        softmax_rows(batch->input, batch->output, batch->request_count, row_length);
+        return;
+    }
+    for (i = 0; i < batch->request_count; i++) {
+        softmax(batch->input + batch->requests[i].offset, batch->output + batch->requests[i].offset,
+                batch->requests[i].length);
+    }
+}
+
+static void coalesce_batch_run(struct coalescer *coalescer, struct coalesce_batch *batch) {
+    struct coalesce_request *request;
+    size_t offset;
+    size_t i;
+    int chunk_count;
+    int chunk;
+
+    if (coalescer->kernel == COALESCE_SOFTMAX) {
+        coalesce_softmax_batch(batch);
+    } else if (coalescer->pool != NULL && batch->element_count >= COALESCE_PARALLEL_ELEMENTS) {
+        chunk_count = thread_pool_size(coalescer->pool);
+        offset = 0;
+        for (chunk = 0; chunk < chunk_count; chunk++) {
+            batch->chunks[chunk].kernel = coalescer->kernel;
+            batch->chunks[chunk].input = batch->input + offset;
+            batch->chunks[chunk].output = batch->output + offset;
+            batch->chunks[chunk].length = batch->element_count / (size_t)chunk_count +
+                                          ((size_t)chunk < batch->element_count % (size_t)chunk_count ? 1 : 0);
+            batch->chunk_arguments[chunk] = &batch->chunks[chunk];
+            offset += batch->chunks[chunk].length;
+        }
+        thread_pool_run(coalescer->pool, coalesce_chunk_task, batch->chunk_arguments, chunk_count);
+    } else {
+        coalesce_kernel_run(coalescer->kernel, batch->input, batch->output, batch->element_count);
+    }
+
+    for (i = 0; i < batch->request_count; i++) {
+        request = &batch->requests[i];
+        memcpy(request->output, batch->output + request->offset, request->length * sizeof(double));
+    }
+}
+
+static struct coalesce_batch *coalesce_open_batch(struct coalescer *coalescer) {
+    struct coalesce_batch *batch;
+    double deadline;
+    int i;
+
+    for (i = 0; i < COALESCE_BATCH_SLOTS; i++) {
+        batch = &coalescer->batches[i];
+        if (batch->state != BATCH_FREE) {
+            continue;
+        }
+        batch->state = BATCH_OPEN;
+        batch->request_count = 0;
+        batch->element_count = 0;
+        batch->full = 0;
+        batch->denormal_flush = denormal_flush_get();
+        batch->probe = coalescer->opened_batches % COALESCE_PROBE_INTERVAL == 0;
+        coalescer->opened_batches++;
+        clock_gettime(CLOCK_MONOTONIC, &batch->deadline);
+        deadline = (double)batch->deadline.tv_nsec * 1e-9 + coalescer->budget_seconds;
+        batch->deadline.tv_sec += (time_t)deadline;
+        batch->deadline.tv_nsec = (long)((deadline - (double)(time_t)deadline) * 1e9);
+        coalescer->open_batch = batch;
+        return batch;
+    }
+    return NULL;
+}
+
+static void coalesce_close_batch(struct coalescer *coalescer, struct coalesce_batch *batch) {
+    batch->full = 1;
+    if (coalescer->open_batch == batch) {
+        coalescer->open_batch = NULL;
+    }
+    pthread_cond_signal(&batch->wake_leader);
+}
+
+struct coalescer *coalescer_create(enum coalesce_kernel kernel, struct thread_pool *pool,
+                                   size_t max_batch_elements, double budget_seconds) {
+    struct coalescer *coalescer;
+    struct coalesce_batch *batch;
+    pthread_condattr_t condition_attributes;
+    int chunk_count;
+    int i;
+
+    if ((unsigned int)kernel > COALESCE_SOFTMAX || max_batch_elements == 0 || !(budget_seconds >= 0.0)) {
+        return NULL;
+    }
+    coalescer = calloc(1, sizeof(*coalescer));
+    if (coalescer == NULL) {
+        return NULL;
+    }
+    coalescer->pool = pool;
+    coalescer->kernel = kernel;
+    coalescer->max_batch_elements = max_batch_elements;
+    coalescer->budget_seconds = budget_seconds;
+    chunk_count = thread_pool_size(pool);
+
+    pthread_condattr_init(&condition_attributes);
+    pthread_condattr_setclock(&condition_attributes, CLOCK_MONOTONIC);
+    pthread_mutex_init(&coalescer->mutex, NULL);
+    pthread_cond_init(&coalescer->slot_free, NULL);
+    for (i = 0; i < COALESCE_BATCH_SLOTS; i++) {
+        pthread_cond_init(&coalescer->batches[i].wake_leader, &condition_attributes);
+        pthread_cond_init(&coalescer->batches[i].done, NULL);
+    }
+    pthread_condattr_destroy(&condition_attributes);
+
+    for (i = 0; i < COALESCE_BATCH_SLOTS; i++) {
+        batch = &coalescer->batches[i];
+        batch->input = malloc(max_batch_elements * sizeof(double));
+        batch->output = malloc(max_batch_elements * sizeof(double));
+        batch->chunks = malloc((size_t)chunk_count * sizeof(*batch->chunks));
+        batch->chunk_arguments = malloc((size_t)chunk_count * sizeof(*batch->chunk_arguments));
+        if (batch->input == NULL || batch->output == NULL || batch->chunks == NULL ||
+            batch->chunk_arguments == NULL) {
+            coalescer_destroy(coalescer);
+            return NULL;
+        }
+    }
+    return coalescer;
+}
+
+void coalescer_destroy(struct coalescer *coalescer) {
+    struct coalesce_batch *batch;
+    int i;
+
+    if (coalescer == NULL) {
+        return;
+    }
+    for (i = 0; i < COALESCE_BATCH_SLOTS; i++) {
+        batch = &coalescer->batches[i];
+        pthread_cond_destroy(&batch->wake_leader);
+        pthread_cond_destroy(&batch->done);
+        free(batch->input);
+        free(batch->output);
+        free(batch->chunks);
+        free(batch->chunk_arguments);
+    }
+    pthread_cond_destroy(&coalescer->slot_free);
+    pthread_mutex_destroy(&coalescer->mutex);
+    free(coalescer);
+}
+
+void coalescer_submit(struct coalescer *coalescer, const double *input, double *output, size_t length) {
+    struct coalesce_batch *batch;
+    struct coalesce_request *request;
+    uint64_t start;
+    uint64_t generation;
+    int denormal_flush;
+    int leader;
+    TRACE_BEGIN();
+
+    if (length == 0) {
+        TRACE_END();
+        return;
+    }
+    start = metrics_now();
+    if (length > coalescer->max_batch_elements) {
+        coalesce_kernel_run(coalescer->kernel, input, output, length);
+        pthread_mutex_lock(&coalescer->mutex);
+        histogram_record(&coalescer->batch_submissions, 1);
+        histogram_record(&coalescer->batch_elements, length);
+        histogram_record(&coalescer->latency, metrics_now() - start);
+        pthread_mutex_unlock(&coalescer->mutex);
+        TRACE_END();
+        return;
+    }
+
+    /* The leader runs the batch under its own flush setting, so a batch only
+       takes submitters with the same setting. */
+    denormal_flush = denormal_flush_get();
+    pthread_mutex_lock(&coalescer->mutex);
+    coalescer->submitters++;
+    for (;;) {
+        batch = coalescer->open_batch;
+        if (batch != NULL && batch->element_count + length <= coalescer->max_batch_elements &&
+            batch->denormal_flush == denormal_flush) {
+            break;
+        }
+        if (batch != NULL) {
+            coalesce_close_batch(coalescer, batch);
+        }
+        batch = coalesce_open_batch(coalescer);
+        if (batch != NULL) {
+            break;
+        }
+        pthread_cond_wait(&coalescer->slot_free, &coalescer->mutex);
+    }
+
+    leader = batch->request_count == 0;
+    request = &batch->requests[batch->request_count];
+    request->output = output;
+    request->length = length;
+    request->offset = batch->element_count;
+    memcpy(batch->input + request->offset, input, length * sizeof(double));
+    batch->request_count++;
+    batch->element_count += length;
+    generation = batch->generation;
+    /* Every COALESCE_PROBE_INTERVAL-th batch waits out its whole budget, and
+       sets expected_batch_submissions to its size; other batches can raise
+       it. A batch that has reached it and holds every thread inside
+       coalescer_submit has nobody left to wait for. */
+    if (batch->element_count == coalescer->max_batch_elements || batch->request_count == COALESCE_MAX_REQUESTS ||
+        (!batch->probe && coalescer->expected_batch_submissions != 0 &&
+         batch->request_count == coalescer->submitters &&
+         batch->request_count >= coalescer->expected_batch_submissions)) {
+        coalesce_close_batch(coalescer, batch);
+    }
+
+    if (leader) {
+        while (!batch->full) {
+            if (pthread_cond_timedwait(&batch->wake_leader, &coalescer->mutex, &batch->deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        if (coalescer->open_batch == batch) {
+            coalescer->open_batch = NULL;
+        }
+        batch->state = BATCH_RUNNING;
+        pthread_mutex_unlock(&coalescer->mutex);
+
+        coalesce_batch_run(coalescer, batch);
+
+        pthread_mutex_lock(&coalescer->mutex);
+        histogram_record(&coalescer->batch_submissions, batch->request_count);
+        histogram_record(&coalescer->batch_elements, batch->element_count);
+        if (batch->probe || batch->request_count > coalescer->expected_batch_submissions) {
+            coalescer->expected_batch_submissions = batch->request_count;
+        }
+        batch->generation++;
+        batch->state = BATCH_FREE;
+        pthread_cond_broadcast(&batch->done);
+        pthread_cond_broadcast(&coalescer->slot_free);
+    } else {
+        while (batch->generation == generation) {
+            pthread_cond_wait(&batch->done, &coalescer->mutex);
+        }
+    }
+    coalescer->submitters--;
+    histogram_record(&coalescer->latency, metrics_now() - start);
+    pthread_mutex_unlock(&coalescer->mutex);
+    TRACE_END();
+}
+
+void coalescer_stats_get(struct coalescer *coalescer, struct coalescer_stats *stats) {
+    pthread_mutex_lock(&coalescer->mutex);
+    stats->submissions = (size_t)coalescer->latency.total;
+    stats->batches = (size_t)coalescer->batch_submissions.total;
+    stats->batch_submissions_p50 = (size_t)histogram_percentile(&coalescer->batch_submissions, 0.5);
+    stats->batch_submissions_p99 = (size_t)histogram_percentile(&coalescer->batch_submissions, 0.99);
+    stats->batch_submissions_max = (size_t)coalescer->batch_submissions.max;
+    stats->batch_elements_p50 = (size_t)histogram_percentile(&coalescer->batch_elements, 0.5);
+    stats->batch_elements_max = (size_t)coalescer->batch_elements.max;
+    stats->latency_p50_seconds = (double)histogram_percentile(&coalescer->latency, 0.5) * 1e-9;
+    stats->latency_p99_seconds = (double)histogram_percentile(&coalescer->latency, 0.99) * 1e-9;
+    stats->latency_p999_seconds = (double)histogram_percentile(&coalescer->latency, 0.999) * 1e-9;
+    stats->latency_max_seconds = (double)coalescer->latency.max * 1e-9;
+    pthread_mutex_unlock(&coalescer->mutex);
+}
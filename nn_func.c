@@ -1,19 +1,63 @@
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 
-double sigmoid(double input_value) {
-    double negative_input;
-    double exp_of_negative;
-    double denominator;
-    double sigmoid_result;
-    negative_input = input_value * -1.0;
-    exp_of_negative = exp(negative_input);
-    denominator = 1.0 + exp_of_negative;
-    sigmoid_result = 1.0 / denominator;
-    return sigmoid_result;
-}
+#include "nn_func.h"
+#include "nn_metrics.h"
+#include "nn_trace.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define NN_FUNC_HAS_MXCSR
+#endif
+
+#define SINCOS_REDUCTION_LIMIT 1.0e6
+#define STATS_BLOCK_LENGTH 512
+
+extern inline double sigmoid(double input_value);
+extern inline double sigmoid_derivative(double input_value);
+extern inline double tanh_activation(double input_value);
+extern inline double tanh_derivative(double input_value);
+extern inline double relu(double input_value);
+extern inline double relu_derivative(double input_value);
+extern inline double leaky_relu(double input_value);
+extern inline double leay_derivative(double input_value, double alpha);
+extern inline double hard_sigmoid(double input_value);
+extern inline double hard_sigmoid_derivative(double input_value);
+extern inline double linear(double input_value);
+extern inline double linear_derivative(double input_value);
+extern inline double elu(double input_value, double alpha);
+extern inline double elu_derivative(double input_value, double alpha);
+extern inline double swish(double input_value);
+extern inline double swish_derivative(double input_value);
+extern inline double softplus(double input_value);
+extern inline double softplus_derivative(double input_value);
+extern inline double gelu(double input_value);
+extern inline double gelu_derivative(double input_value);
+extern inline double sigmoid_second_derivative(double input_value);
+extern inline double tanh_second_derivative(double input_value);
+extern inline double elu_second_derivative(double input_value, double alpha);
+extern inline double swish_second_derivative(double input_value);
+extern inline double softplus_second_derivative(double input_value);
+extern inline double gelu_second_derivative(double input_value);
+extern inline double sine_activation(double input_value, double omega);
+extern inline double sine_derivative(double input_value, double omega);
+extern inline double cosine_activation(double input_value, double omega);
+extern inline double cosine_derivative(double input_value, double omega);
+extern inline struct dual_number sigmoid_dual(struct dual_number input);
+extern inline struct dual_number tanh_dual(struct dual_number input);
+extern inline struct dual_number relu_dual(struct dual_number input);
+extern inline struct dual_number leaky_relu_dual(struct dual_number input);
+extern inline struct dual_number hard_sigmoid_dual(struct dual_number input);
+extern inline struct dual_number linear_dual(struct dual_number input);
+extern inline struct dual_number elu_dual(struct dual_number input, double alpha);
+extern inline struct dual_number swish_dual(struct dual_number input);
+extern inline struct dual_number softplus_dual(struct dual_number input);
+extern inline struct dual_number gelu_dual(struct dual_number input);
 
 double sigmoid_error_handl(double input_value) {
     double negative_input;
@@ -47,125 +91,1642 @@ double sigmoid_error_handl(double input_value) {
     return sigmoid_result;
 }
 
-double sigmoid_derivative(double input_value) {
-    double sig_val = sigmoid(input_value);
-    return sig_val * (1.0 - sig_val);
-}   
+#define ACTIVATION_BLOCK_LENGTH 64
+#define BLOCK_ALL_POSITIVE 1
+#define BLOCK_ALL_NEGATIVE -1
+#define BLOCK_MIXED 0
+#define ACTIVATION_MIXED_RUN_SKIP (16 * ACTIVATION_BLOCK_LENGTH)
+#define INCREMENTAL_DIRTY_FRACTION 4
+#define SOFTMAX_SHIFT_SLACK 64.0
+#define SOFTMAX_CANCELLATION_LIMIT 1e-3
+#define ACTIVATION_CACHE_BITS 9
+#define ACTIVATION_CACHE_ENTRIES (1 << ACTIVATION_CACHE_BITS)
+#define ACTIVATION_CACHE_WINDOW 4096
+#define ACTIVATION_CACHE_MIN_HITS (ACTIVATION_CACHE_WINDOW / 4)
+#define ACTIVATION_CACHE_RETRY ((size_t)1 << 20)
+#define ACTIVATION_CACHE_EMPTY_KEY UINT64_C(0x7ff8dead00000000)
+#define MXCSR_FLUSH_TO_ZERO 0x8000
+#define MXCSR_DENORMALS_ARE_ZERO 0x0040
+
+static _Thread_local struct block_path_stats block_stats;
+
+static int block_kind(const double *lane_counts) {
+    double positive_count;
+    int lane;
+
+    positive_count = 0.0;
+    for (lane = 0; lane < 8; lane++) {
+        positive_count += lane_counts[lane];
+    }
+    if (positive_count == ACTIVATION_BLOCK_LENGTH) {
+        return BLOCK_ALL_POSITIVE;
+    }
+    if (positive_count == 0.0) {
+        return BLOCK_ALL_NEGATIVE;
+    }
+    return BLOCK_MIXED;
+}
+
+/* Randomly signed data almost always disagrees within the first eight
+   elements, so those are checked on their own before the rest. */
+static int classify_block(const double *block) {
+    double lane_counts[8];
+    double first_count;
+    int i;
+    int lane;
+
+    first_count = 0.0;
+    for (lane = 0; lane < 8; lane++) {
+        lane_counts[lane] = block[lane] > 0.0 ? 1.0 : 0.0;
+        first_count += lane_counts[lane];
+    }
+    if (first_count != 0.0 && first_count != 8.0) {
+        return BLOCK_MIXED;
+    }
+    for (i = 8; i < ACTIVATION_BLOCK_LENGTH; i += 8) {
+        for (lane = 0; lane < 8; lane++) {
+            lane_counts[lane] += block[i + lane] > 0.0 ? 1.0 : 0.0;
+        }
+    }
+    return block_kind(lane_counts);
+}
+
+/* Returns the end of the run of blocks from start that share the kind of the
+   first, so each run is handled by one loop. Within a mixed run the probes
+   back off, taking twice as many blocks on trust after each mixed probe up to
+   ACTIVATION_MIXED_RUN_SKIP elements, so randomly signed data pays for a
+   handful of probes per array rather than one per block. */
+static size_t block_run(const double *input_array, size_t start, size_t full_length, int *kind) {
+    size_t end;
+    size_t skip;
 
-double tanh_activation(double input_value) {
-    double tanh_result;
-    tanh_result = tanh(input_value);
-    return tanh_result;
+    *kind = classify_block(input_array + start);
+    end = start + ACTIVATION_BLOCK_LENGTH;
+    if (*kind != BLOCK_MIXED) {
+        while (end < full_length && classify_block(input_array + end) == *kind) {
+            end += ACTIVATION_BLOCK_LENGTH;
+        }
+        return end;
+    }
+    skip = ACTIVATION_BLOCK_LENGTH;
+    while (end < full_length && classify_block(input_array + end) == BLOCK_MIXED) {
+        end += skip;
+        if (skip < ACTIVATION_MIXED_RUN_SKIP) {
+            skip *= 2;
+        }
+    }
+    return end < full_length ? end : full_length;
+}
 
+void block_path_stats_get(struct block_path_stats *stats) {
+    *stats = block_stats;
 }
 
-double tanh_derivative(double input_value) {
-    double tanh_val;
-    double tanh_squared;
-    double derivative_result;
+void block_path_stats_reset(void) {
+    block_stats.positive_blocks = 0;
+    block_stats.negative_blocks = 0;
+    block_stats.mixed_blocks = 0;
+}
 
-    tanh_val = tanh_activation(input_value);
+static _Thread_local int denormal_flush_enabled;
 
-    tanh_squared = tanh_val * tanh_val;
-    derivative_result = 1.0 - tanh_squared;
-    
-    return derivative_result;
+void denormal_flush_set(int enabled) {
+    denormal_flush_enabled = enabled != 0;
 }
 
-double relu(double input_value) {
-    if (input_value > 0.0) {
-        return input_value;
-    } else {
-        return 0.0;
+int denormal_flush_get(void) {
+    return denormal_flush_enabled;
+}
+
+static unsigned int denormal_scope_enter(void) {
+#ifdef NN_FUNC_HAS_MXCSR
+    unsigned int saved_mxcsr;
+
+    if (!denormal_flush_enabled) {
+        return 0;
     }
+    saved_mxcsr = _mm_getcsr();
+    _mm_setcsr(saved_mxcsr | MXCSR_FLUSH_TO_ZERO | MXCSR_DENORMALS_ARE_ZERO);
+    return saved_mxcsr;
+#else
+    return 0;
+#endif
 }
 
-double relu_derivative(double input_value) {
-    if (input_value > 0.0) {
-        return 1.0;
-    } else {
-        return 0.0;
+static void denormal_scope_exit(unsigned int saved_mxcsr) {
+#ifdef NN_FUNC_HAS_MXCSR
+    if (denormal_flush_enabled) {
+        _mm_setcsr(saved_mxcsr);
     }
+#else
+    (void)saved_mxcsr;
+#endif
 }
 
-double leaky_relu(double input_value) {
-    double alpha;
-    alpha = 0.01;
-    if (input_value > 0.0) {
-        return input_value;
-    } else {
-        return alpha * input_value;
+struct cache_entry {
+    uint64_t key;
+    double value;
+};
+
+/* Each function keeps its own hit-rate window and bypass state, so a table
+   that misses does not switch off one that hits. */
+struct cache_table {
+    struct cache_entry entries[ACTIVATION_CACHE_ENTRIES];
+    struct activation_cache_stats stats;
+    size_t window_lookups;
+    size_t window_hits;
+    size_t bypass_remaining;
+};
+
+struct activation_cache {
+    struct cache_table sigmoid_table;
+    struct cache_table tanh_table;
+    int initialised;
+};
+
+static _Thread_local struct activation_cache activation_cache;
+
+void activation_cache_stats_get(struct activation_cache_stats *sigmoid_stats,
+                                struct activation_cache_stats *tanh_stats) {
+    if (!activation_cache.initialised) {
+        activation_cache_reset();
     }
+    *sigmoid_stats = activation_cache.sigmoid_table.stats;
+    *tanh_stats = activation_cache.tanh_table.stats;
 }
 
-double leay_derivative(double input_value, double alpha) {
-    if (input_value > 0.0) {
-        return 1.0;
-    } else {
-        return alpha;
+static void cache_table_reset(struct cache_table *table) {
+    int i;
+
+    for (i = 0; i < ACTIVATION_CACHE_ENTRIES; i++) {
+        table->entries[i].key = ACTIVATION_CACHE_EMPTY_KEY;
     }
+    table->stats.lookups = 0;
+    table->stats.hits = 0;
+    table->stats.bypassed = 0;
+    table->stats.enabled = 1;
+    table->window_lookups = 0;
+    table->window_hits = 0;
+    table->bypass_remaining = 0;
+}
+
+void activation_cache_reset(void) {
+    cache_table_reset(&activation_cache.sigmoid_table);
+    cache_table_reset(&activation_cache.tanh_table);
+    activation_cache.initialised = 1;
 }
-/*
 
-void softmax(double input_array, double output_array, double array_length) {
-    double max_val = input_array[0];
+/* NaN inputs skip the table: their bit patterns are not canonical, and one
+   of them is the empty key. */
+static void cached_array(struct cache_table *table, activation_function activation,
+                         void (*array_kernel)(const double *, double *, size_t),
+                         const double *input_array, double *output_array, size_t array_length) {
+    struct cache_entry *entry;
+    unsigned int saved_mxcsr;
+    uint64_t key;
+    double input_value;
+    double result;
+    size_t chunk;
+    size_t hits;
+    size_t start;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    start = 0;
+    while (start < array_length) {
+        chunk = array_length - start;
+        if (!table->stats.enabled) {
+            if (chunk > table->bypass_remaining) {
+                chunk = table->bypass_remaining;
+            }
+            array_kernel(input_array + start, output_array + start, chunk);
+            table->stats.bypassed += chunk;
+            table->bypass_remaining -= chunk;
+            if (table->bypass_remaining == 0) {
+                table->stats.enabled = 1;
+            }
+            start += chunk;
+            continue;
+        }
+
+        if (chunk > ACTIVATION_CACHE_WINDOW - table->window_lookups) {
+            chunk = ACTIVATION_CACHE_WINDOW - table->window_lookups;
+        }
+        hits = 0;
+        for (i = start; i < start + chunk; i++) {
+            input_value = input_array[i];
+            if (input_value != input_value) {
+                output_array[i] = activation(input_value);
+                continue;
+            }
+            memcpy(&key, &input_value, sizeof(key));
+            entry = &table->entries[(key * UINT64_C(0x9e3779b97f4a7c15)) >> (64 - ACTIVATION_CACHE_BITS)];
+            if (entry->key == key) {
+                output_array[i] = entry->value;
+                hits++;
+            } else {
+                result = activation(input_value);
+                entry->key = key;
+                entry->value = result;
+                output_array[i] = result;
+            }
+        }
+        table->stats.lookups += chunk;
+        table->stats.hits += hits;
+        table->window_lookups += chunk;
+        table->window_hits += hits;
+        if (table->window_lookups == ACTIVATION_CACHE_WINDOW) {
+            if (table->window_hits < ACTIVATION_CACHE_MIN_HITS) {
+                table->stats.enabled = 0;
+                table->bypass_remaining = ACTIVATION_CACHE_RETRY;
+            }
+            table->window_lookups = 0;
+            table->window_hits = 0;
+        }
+        start += chunk;
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void sigmoid_array_cached(const double *input_array, double *output_array, size_t array_length) {
+    if (!activation_cache.initialised) {
+        activation_cache_reset();
+    }
+    cached_array(&activation_cache.sigmoid_table, sigmoid, sigmoid_array, input_array, output_array, array_length);
+}
+
+void tanh_array_cached(const double *input_array, double *output_array, size_t array_length) {
+    if (!activation_cache.initialised) {
+        activation_cache_reset();
+    }
+    cached_array(&activation_cache.tanh_table, tanh_activation, tanh_array, input_array, output_array, array_length);
+}
+
+static void softmax_row(const double *input_array, double *output_array, size_t array_length) {
+    double max_val;
+    double sum_exp;
+    double inverse_sum;
+    size_t i;
+
+    max_val = input_array[0];
     for (i = 1; i < array_length; i++) {
         if (input_array[i] > max_val) {
-            max_val = input_array[i]
+            max_val = input_array[i];
         }
     }
+
+    sum_exp = 0.0;
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = exp(input_array[i] - max_val);
+        sum_exp = sum_exp + output_array[i];
+    }
+
+    inverse_sum = 1.0 / sum_exp;
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = output_array[i] * inverse_sum;
+    }
 }
 
-*/
+void softmax(const double *input_array, double *output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
 
-double hard_sigmoid(double input_value) {
-    double result  = 0.2 * input_value + 0.5;
-    if (result < 0.0) {
-        return 0.0;
-    } else if (result > 1.0) {
-        return 1.0;
-    } else {
-        return result;
+    if (array_length == 0) {
+        TRACE_END();
+        return;
     }
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    softmax_row(input_array, output_array, array_length);
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_SOFTMAX, metrics_start, output_array, array_length);
+    TRACE_END();
 }
 
-double hard_sigmoid_derivative(double input_value) {
-    if (input_value < -2.5 || input_value > 2.5) {
-        return 0.0;
-    } else {
-        return 0.2;
+/* Pays for the trace event, the metrics and the MXCSR switch once per call
+   rather than once per row. */
+void softmax_rows(const double *input_array, double *output_array, size_t row_count, size_t row_length) {
+    unsigned int saved_mxcsr;
+    size_t row;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    if (row_count == 0 || row_length == 0) {
+        TRACE_END();
+        return;
     }
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    for (row = 0; row < row_count; row++) {
+        softmax_row(input_array + row * row_length, output_array + row * row_length, row_length);
+    }
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_SOFTMAX, metrics_start, output_array, row_count * row_length);
+    TRACE_END();
 }
 
-double linear(double input_value) {
-    return input_value;
+void activation_array_update(activation_function activation, const double *input_array, double *output_array, size_t array_length, const size_t *dirty_indices, size_t dirty_count) {
+    size_t i;
+
+    if (dirty_count * INCREMENTAL_DIRTY_FRACTION > array_length) {
+        for (i = 0; i < array_length; i++) {
+            output_array[i] = activation(input_array[i]);
+        }
+        return;
+    }
+    for (i = 0; i < dirty_count; i++) {
+        output_array[dirty_indices[i]] = activation(input_array[dirty_indices[i]]);
+    }
+}
+
+static void softmax_normalize(const double *exp_values, double *output_array, size_t array_length, double sum_exp) {
+    double inverse_sum;
+    size_t i;
+
+    inverse_sum = 1.0 / sum_exp;
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = exp_values[i] * inverse_sum;
+    }
+}
+
+void softmax_incremental_init(const double *input_array, double *exp_values, double *output_array, size_t array_length, struct softmax_state *state) {
+    unsigned int saved_mxcsr;
+    double max_val;
+    double sum_exp;
+    size_t i;
+
+    state->shift = 0.0;
+    state->sum_exp = 0.0;
+    state->peak_sum = 0.0;
+    if (array_length == 0) {
+        return;
+    }
+    saved_mxcsr = denormal_scope_enter();
+    max_val = input_array[0];
+    for (i = 1; i < array_length; i++) {
+        if (input_array[i] > max_val) {
+            max_val = input_array[i];
+        }
+    }
+
+    sum_exp = 0.0;
+    for (i = 0; i < array_length; i++) {
+        exp_values[i] = exp(input_array[i] - max_val);
+        sum_exp = sum_exp + exp_values[i];
+    }
+    state->shift = max_val;
+    state->sum_exp = sum_exp;
+    state->peak_sum = sum_exp;
+    softmax_normalize(exp_values, output_array, array_length, sum_exp);
+    denormal_scope_exit(saved_mxcsr);
+}
+
+/* The shift stays at the old maximum while new inputs exceed it by at most
+   SOFTMAX_SHIFT_SLACK, so exp() cannot overflow. The running sum carries a
+   rounding error of about one ulp of the largest value it has held since the
+   last full pass, so a full pass also runs once it falls below
+   SOFTMAX_CANCELLATION_LIMIT of that peak; comparing only with the previous
+   call would let a sum that shrinks a little each time drift without bound. */
+void softmax_incremental_update(const double *input_array, double *exp_values, double *output_array, size_t array_length, const size_t *dirty_indices, size_t dirty_count, struct softmax_state *state) {
+    unsigned int saved_mxcsr;
+    double peak_sum;
+    double sum_exp;
+    double new_value;
+    size_t index;
+    size_t i;
+
+    if (dirty_count * INCREMENTAL_DIRTY_FRACTION > array_length) {
+        softmax_incremental_init(input_array, exp_values, output_array, array_length, state);
+        return;
+    }
+    saved_mxcsr = denormal_scope_enter();
+    peak_sum = state->peak_sum;
+    sum_exp = state->sum_exp;
+    for (i = 0; i < dirty_count; i++) {
+        index = dirty_indices[i];
+        if (!(input_array[index] - state->shift <= SOFTMAX_SHIFT_SLACK)) {
+            denormal_scope_exit(saved_mxcsr);
+            softmax_incremental_init(input_array, exp_values, output_array, array_length, state);
+            return;
+        }
+        new_value = exp(input_array[index] - state->shift);
+        sum_exp = sum_exp + (new_value - exp_values[index]);
+        exp_values[index] = new_value;
+        if (sum_exp > peak_sum) {
+            peak_sum = sum_exp;
+        }
+    }
+    if (!(sum_exp > SOFTMAX_CANCELLATION_LIMIT * peak_sum)) {
+        denormal_scope_exit(saved_mxcsr);
+        softmax_incremental_init(input_array, exp_values, output_array, array_length, state);
+        return;
+    }
+    state->sum_exp = sum_exp;
+    state->peak_sum = peak_sum;
+    softmax_normalize(exp_values, output_array, array_length, sum_exp);
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void sigmoid_array(const double *input_array, double *output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = sigmoid(input_array[i]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_SIGMOID_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void sigmoid_derivative_array(const double *input_array, double *output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = sigmoid_derivative(input_array[i]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_SIGMOID_DERIVATIVE_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void tanh_array(const double *input_array, double *output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = tanh_activation(input_array[i]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_TANH_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void tanh_derivative_array(const double *input_array, double *output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = tanh_derivative(input_array[i]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_TANH_DERIVATIVE_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void relu_array(const double *input_array, double *output_array, size_t array_length) {
+    size_t positive_blocks;
+    size_t negative_blocks;
+    size_t mixed_blocks;
+    size_t start;
+    size_t end;
+    size_t full_length;
+    size_t i;
+    int kind;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    positive_blocks = 0;
+    negative_blocks = 0;
+    mixed_blocks = 0;
+    full_length = array_length - array_length % ACTIVATION_BLOCK_LENGTH;
+    for (start = 0; start < full_length; start = end) {
+        end = block_run(input_array, start, full_length, &kind);
+        switch (kind) {
+        case BLOCK_ALL_POSITIVE:
+            positive_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            if (output_array != input_array) {
+                memcpy(output_array + start, input_array + start, (end - start) * sizeof(double));
+            }
+            break;
+        case BLOCK_ALL_NEGATIVE:
+            negative_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = 0.0;
+            }
+            break;
+        default:
+            mixed_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = input_array[i] > 0.0 ? input_array[i] : 0.0;
+            }
+            break;
+        }
+    }
+    for (i = start; i < array_length; i++) {
+        output_array[i] = relu(input_array[i]);
+    }
+    block_stats.positive_blocks += positive_blocks;
+    block_stats.negative_blocks += negative_blocks;
+    block_stats.mixed_blocks += mixed_blocks;
+    metrics_end(METRICS_RELU_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void relu_derivative_array(const double *input_array, double *output_array, size_t array_length) {
+    size_t positive_blocks;
+    size_t negative_blocks;
+    size_t mixed_blocks;
+    size_t start;
+    size_t end;
+    size_t full_length;
+    size_t i;
+    int kind;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    positive_blocks = 0;
+    negative_blocks = 0;
+    mixed_blocks = 0;
+    full_length = array_length - array_length % ACTIVATION_BLOCK_LENGTH;
+    for (start = 0; start < full_length; start = end) {
+        end = block_run(input_array, start, full_length, &kind);
+        switch (kind) {
+        case BLOCK_ALL_POSITIVE:
+            positive_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = 1.0;
+            }
+            break;
+        case BLOCK_ALL_NEGATIVE:
+            negative_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = 0.0;
+            }
+            break;
+        default:
+            mixed_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = input_array[i] > 0.0 ? 1.0 : 0.0;
+            }
+            break;
+        }
+    }
+    for (i = start; i < array_length; i++) {
+        output_array[i] = relu_derivative(input_array[i]);
+    }
+    block_stats.positive_blocks += positive_blocks;
+    block_stats.negative_blocks += negative_blocks;
+    block_stats.mixed_blocks += mixed_blocks;
+    metrics_end(METRICS_RELU_DERIVATIVE_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void leaky_relu_array(const double *input_array, double *output_array, size_t array_length) {
+    static const double leaky_slopes[2] = {0.01, 1.0};
+    size_t positive_blocks;
+    size_t negative_blocks;
+    size_t mixed_blocks;
+    size_t start;
+    size_t end;
+    size_t full_length;
+    size_t i;
+    int kind;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    positive_blocks = 0;
+    negative_blocks = 0;
+    mixed_blocks = 0;
+    full_length = array_length - array_length % ACTIVATION_BLOCK_LENGTH;
+    for (start = 0; start < full_length; start = end) {
+        end = block_run(input_array, start, full_length, &kind);
+        switch (kind) {
+        case BLOCK_ALL_POSITIVE:
+            positive_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            if (output_array != input_array) {
+                memcpy(output_array + start, input_array + start, (end - start) * sizeof(double));
+            }
+            break;
+        case BLOCK_ALL_NEGATIVE:
+            negative_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = 0.01 * input_array[i];
+            }
+            break;
+        default:
+            mixed_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                /* A table lookup rather than a select, which gcc keeps as a
+                   branch that mispredicts on mixed signs. */
+                output_array[i] = input_array[i] * leaky_slopes[input_array[i] > 0.0];
+            }
+            break;
+        }
+    }
+    for (i = start; i < array_length; i++) {
+        output_array[i] = leaky_relu(input_array[i]);
+    }
+    block_stats.positive_blocks += positive_blocks;
+    block_stats.negative_blocks += negative_blocks;
+    block_stats.mixed_blocks += mixed_blocks;
+    metrics_end(METRICS_LEAKY_RELU_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void leaky_relu_derivative_array(const double *input_array, double *output_array, size_t array_length, double alpha) {
+    size_t positive_blocks;
+    size_t negative_blocks;
+    size_t mixed_blocks;
+    size_t start;
+    size_t end;
+    size_t full_length;
+    size_t i;
+    int kind;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    positive_blocks = 0;
+    negative_blocks = 0;
+    mixed_blocks = 0;
+    full_length = array_length - array_length % ACTIVATION_BLOCK_LENGTH;
+    for (start = 0; start < full_length; start = end) {
+        end = block_run(input_array, start, full_length, &kind);
+        switch (kind) {
+        case BLOCK_ALL_POSITIVE:
+            positive_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = 1.0;
+            }
+            break;
+        case BLOCK_ALL_NEGATIVE:
+            negative_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = alpha;
+            }
+            break;
+        default:
+            mixed_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = input_array[i] > 0.0 ? 1.0 : alpha;
+            }
+            break;
+        }
+    }
+    for (i = start; i < array_length; i++) {
+        output_array[i] = leay_derivative(input_array[i], alpha);
+    }
+    block_stats.positive_blocks += positive_blocks;
+    block_stats.negative_blocks += negative_blocks;
+    block_stats.mixed_blocks += mixed_blocks;
+    metrics_end(METRICS_LEAKY_RELU_DERIVATIVE_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void hard_sigmoid_array(const double *input_array, double *output_array, size_t array_length) {
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = hard_sigmoid(input_array[i]);
+    }
+    metrics_end(METRICS_HARD_SIGMOID_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void hard_sigmoid_derivative_array(const double *input_array, double *output_array, size_t array_length) {
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = hard_sigmoid_derivative(input_array[i]);
+    }
+    metrics_end(METRICS_HARD_SIGMOID_DERIVATIVE_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void elu_array(const double *input_array, double *output_array, size_t array_length, double alpha) {
+    unsigned int saved_mxcsr;
+    size_t positive_blocks;
+    size_t negative_blocks;
+    size_t mixed_blocks;
+    size_t start;
+    size_t end;
+    size_t full_length;
+    size_t i;
+    int kind;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    positive_blocks = 0;
+    negative_blocks = 0;
+    mixed_blocks = 0;
+    full_length = array_length - array_length % ACTIVATION_BLOCK_LENGTH;
+    for (start = 0; start < full_length; start = end) {
+        end = block_run(input_array, start, full_length, &kind);
+        switch (kind) {
+        case BLOCK_ALL_POSITIVE:
+            positive_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            if (output_array != input_array) {
+                memcpy(output_array + start, input_array + start, (end - start) * sizeof(double));
+            }
+            break;
+        case BLOCK_ALL_NEGATIVE:
+            negative_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = alpha * (exp(input_array[i]) - 1.0);
+            }
+            break;
+        default:
+            mixed_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = elu(input_array[i], alpha);
+            }
+            break;
+        }
+    }
+    for (i = start; i < array_length; i++) {
+        output_array[i] = elu(input_array[i], alpha);
+    }
+    block_stats.positive_blocks += positive_blocks;
+    block_stats.negative_blocks += negative_blocks;
+    block_stats.mixed_blocks += mixed_blocks;
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_ELU_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void elu_derivative_array(const double *input_array, double *output_array, size_t array_length, double alpha) {
+    unsigned int saved_mxcsr;
+    size_t positive_blocks;
+    size_t negative_blocks;
+    size_t mixed_blocks;
+    size_t start;
+    size_t end;
+    size_t full_length;
+    size_t i;
+    int kind;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    positive_blocks = 0;
+    negative_blocks = 0;
+    mixed_blocks = 0;
+    full_length = array_length - array_length % ACTIVATION_BLOCK_LENGTH;
+    for (start = 0; start < full_length; start = end) {
+        end = block_run(input_array, start, full_length, &kind);
+        switch (kind) {
+        case BLOCK_ALL_POSITIVE:
+            positive_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = 1.0;
+            }
+            break;
+        case BLOCK_ALL_NEGATIVE:
+            negative_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = alpha * (exp(input_array[i]) - 1.0) + alpha;
+            }
+            break;
+        default:
+            mixed_blocks += (end - start) / ACTIVATION_BLOCK_LENGTH;
+            for (i = start; i < end; i++) {
+                output_array[i] = elu_derivative(input_array[i], alpha);
+            }
+            break;
+        }
+    }
+    for (i = start; i < array_length; i++) {
+        output_array[i] = elu_derivative(input_array[i], alpha);
+    }
+    block_stats.positive_blocks += positive_blocks;
+    block_stats.negative_blocks += negative_blocks;
+    block_stats.mixed_blocks += mixed_blocks;
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_ELU_DERIVATIVE_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void swish_array(const double *input_array, double *output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = swish(input_array[i]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_SWISH_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void swish_derivative_array(const double *input_array, double *output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = swish_derivative(input_array[i]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+    metrics_end(METRICS_SWISH_DERIVATIVE_ARRAY, metrics_start, output_array, array_length);
+    TRACE_END();
+}
+
+void sigmoid_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = sigmoid(input_array[(ptrdiff_t)i * input_stride]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void sigmoid_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = sigmoid_derivative(input_array[(ptrdiff_t)i * input_stride]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void tanh_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = tanh_activation(input_array[(ptrdiff_t)i * input_stride]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void tanh_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = tanh_derivative(input_array[(ptrdiff_t)i * input_stride]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void relu_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = relu(input_array[(ptrdiff_t)i * input_stride]);
+    }
+}
+
+void relu_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = relu_derivative(input_array[(ptrdiff_t)i * input_stride]);
+    }
+}
+
+void leaky_relu_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = leaky_relu(input_array[(ptrdiff_t)i * input_stride]);
+    }
+}
+
+void leaky_relu_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length, double alpha) {
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = leay_derivative(input_array[(ptrdiff_t)i * input_stride], alpha);
+    }
+}
+
+void hard_sigmoid_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = hard_sigmoid(input_array[(ptrdiff_t)i * input_stride]);
+    }
+}
+
+void hard_sigmoid_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = hard_sigmoid_derivative(input_array[(ptrdiff_t)i * input_stride]);
+    }
+}
+
+void elu_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length, double alpha) {
+    unsigned int saved_mxcsr;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = elu(input_array[(ptrdiff_t)i * input_stride], alpha);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void elu_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length, double alpha) {
+    unsigned int saved_mxcsr;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = elu_derivative(input_array[(ptrdiff_t)i * input_stride], alpha);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void swish_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = swish(input_array[(ptrdiff_t)i * input_stride]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void swish_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length) {
+    unsigned int saved_mxcsr;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        output_array[(ptrdiff_t)i * output_stride] = swish_derivative(input_array[(ptrdiff_t)i * input_stride]);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+/* The fused derivative kernels below work on two doubles at a time with a
+   polynomial exp instead of calling libm per element, which gcc cannot
+   vectorize. Comparisons give all-ones lanes, so selects are bit masks. */
+typedef double derivative_vector __attribute__((vector_size(2 * sizeof(double))));
+typedef int64_t derivative_mask __attribute__((vector_size(2 * sizeof(int64_t))));
+
+#define DERIVATIVE_EXP_SHIFTER 0x1.8p52
+#define DERIVATIVE_LN2_HI 6.93147180369123816490e-01
+#define DERIVATIVE_LN2_LO 1.90821492927058770002e-10
+#define DERIVATIVE_SIGN_MASK INT64_C(0x8000000000000000)
+
+static inline derivative_vector derivative_splat(double value) {
+    return (derivative_vector){value, value};
+}
+
+static inline derivative_vector derivative_select(derivative_mask mask, derivative_vector if_true, derivative_vector if_false) {
+    return (derivative_vector)(((derivative_mask)if_true & mask) | ((derivative_mask)if_false & ~mask));
+}
+
+/* Clamping with compares keeps NaN lanes as NaN. */
+static inline derivative_vector derivative_clamp(derivative_vector input_value, double low, double high) {
+    input_value = derivative_select((derivative_mask)(input_value < derivative_splat(low)), derivative_splat(low), input_value);
+    return derivative_select((derivative_mask)(input_value > derivative_splat(high)), derivative_splat(high), input_value);
+}
+
+/* Splits x into k ln2 + r with |r| <= ln2 / 2 and returns e^r - 1 from its
+   Taylor series, which is below an ulp by the r^13 term. The terms are
+   paired (Estrin) so the multiplies do not wait on one another. */
+static inline derivative_vector derivative_expm1_reduced(derivative_vector input_value, derivative_mask *exponent) {
+    derivative_vector shifted;
+    derivative_vector whole;
+    derivative_vector reduced;
+    derivative_vector squared;
+    derivative_vector fourth;
+    derivative_vector series;
+
+    shifted = input_value * derivative_splat(1.4426950408889634) + derivative_splat(DERIVATIVE_EXP_SHIFTER);
+    whole = shifted - derivative_splat(DERIVATIVE_EXP_SHIFTER);
+    *exponent = (derivative_mask)shifted - (derivative_mask)derivative_splat(DERIVATIVE_EXP_SHIFTER);
+    reduced = (input_value - whole * derivative_splat(DERIVATIVE_LN2_HI)) - whole * derivative_splat(DERIVATIVE_LN2_LO);
+
+    squared = reduced * reduced;
+    fourth = squared * squared;
+    series = (derivative_splat(0.5) + reduced * derivative_splat(1.0 / 6.0)) +
+             squared * (derivative_splat(1.0 / 24.0) + reduced * derivative_splat(1.0 / 120.0));
+    series = series + fourth * ((derivative_splat(1.0 / 720.0) + reduced * derivative_splat(1.0 / 5040.0)) +
+                                squared * (derivative_splat(1.0 / 40320.0) + reduced * derivative_splat(1.0 / 362880.0)));
+    series = series + fourth * fourth * ((derivative_splat(1.0 / 3628800.0) + reduced * derivative_splat(1.0 / 39916800.0)) +
+                                         squared * (derivative_splat(1.0 / 479001600.0) + reduced * derivative_splat(1.0 / 6227020800.0)));
+    return reduced + squared * series;
+}
+
+static inline derivative_vector derivative_power_of_two(derivative_mask exponent) {
+    return (derivative_vector)((exponent + 1023) << 52);
 }
 
-double linear_derivative(double input_value) {
-    return 1.0;
+/* 2^k is applied as two factors so results between the denormals and
+   overflow come out without a bad exponent field. */
+static inline derivative_vector derivative_exp(derivative_vector input_value) {
+    derivative_vector fraction;
+    derivative_mask exponent;
+    derivative_mask half_exponent;
+
+    input_value = derivative_clamp(input_value, -746.0, 710.0);
+    fraction = derivative_expm1_reduced(input_value, &exponent);
+    half_exponent = exponent >> 1;
+    return (fraction + derivative_splat(1.0)) * derivative_power_of_two(half_exponent) *
+           derivative_power_of_two(exponent - half_exponent);
 }
 
-double elu(double input_value, double alpha) {
-    if (input_value > 0.0) {
-        return input_value;
+/* e^x - 1 without cancellation near zero; past -40 it is -1 in doubles. */
+static inline derivative_vector derivative_expm1(derivative_vector input_value) {
+    derivative_vector fraction;
+    derivative_vector scale;
+    derivative_mask exponent;
+
+    input_value = derivative_clamp(input_value, -40.0, 709.0);
+    fraction = derivative_expm1_reduced(input_value, &exponent);
+    scale = derivative_power_of_two(exponent);
+    return scale * fraction + (scale - derivative_splat(1.0));
+}
+
+/* log(1 + u) for u in [0, 1] as 2 atanh(z). Above sqrt(2) - 1 the argument
+   is halved first, z = (u - 1) / (u + 3), which keeps |z| <= 0.172 on both
+   sides without rounding 1 + u. */
+static inline derivative_vector derivative_log1p_unit(derivative_vector input_value) {
+    derivative_mask upper;
+    derivative_vector ratio;
+    derivative_vector ratio_squared;
+    derivative_vector ratio_fourth;
+    derivative_vector series;
+
+    upper = (derivative_mask)(input_value > derivative_splat(0.41421356237309503));
+    ratio = derivative_select(upper, (input_value - derivative_splat(1.0)) / (input_value + derivative_splat(3.0)),
+                              input_value / (input_value + derivative_splat(2.0)));
+    ratio_squared = ratio * ratio;
+    ratio_fourth = ratio_squared * ratio_squared;
+    series = (derivative_splat(1.0 / 3.0) + ratio_squared * derivative_splat(1.0 / 5.0)) +
+             ratio_fourth * (derivative_splat(1.0 / 7.0) + ratio_squared * derivative_splat(1.0 / 9.0));
+    series = series + ratio_fourth * ratio_fourth *
+                          ((derivative_splat(1.0 / 11.0) + ratio_squared * derivative_splat(1.0 / 13.0)) +
+                           ratio_fourth * (derivative_splat(1.0 / 15.0) + ratio_squared * derivative_splat(1.0 / 17.0)) +
+                           ratio_fourth * ratio_fourth * (derivative_splat(1.0 / 19.0) + ratio_squared * derivative_splat(1.0 / 21.0)));
+    return derivative_select(upper, derivative_splat(0.6931471805599453), derivative_splat(0.0)) +
+           derivative_splat(2.0) * ratio * (derivative_splat(1.0) + ratio_squared * series);
+}
+
+/* Loads two inputs; a last odd element is padded with zero. */
+static inline derivative_vector derivative_load(const double *input_array, size_t i, size_t array_length) {
+    derivative_vector input_value;
+
+    if (i + 2 <= array_length) {
+        memcpy(&input_value, input_array + i, sizeof(input_value));
     } else {
-        return alpha * (exp(input_value) - 1.0);
+        input_value = (derivative_vector){input_array[i], 0.0};
     }
+    return input_value;
 }
 
-double elu_derivative(double input_value, double alpha) {
-    if (input_value > 0.0) {
-        return 1.0;
+static inline void derivative_store(double *output_array, size_t i, size_t array_length, derivative_vector output_value) {
+    if (i + 2 <= array_length) {
+        memcpy(output_array + i, &output_value, sizeof(output_value));
     } else {
-        return elu(input_value, alpha) + alpha;
+        output_array[i] = output_value[0];
+    }
+}
+
+void sigmoid_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    derivative_vector sig_val;
+    derivative_vector first;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i += 2) {
+        sig_val = derivative_splat(1.0) / (derivative_splat(1.0) + derivative_exp(-derivative_load(input_array, i, array_length)));
+        first = sig_val * (derivative_splat(1.0) - sig_val);
+        derivative_store(value_array, i, array_length, sig_val);
+        derivative_store(first_array, i, array_length, first);
+        derivative_store(second_array, i, array_length, first * (derivative_splat(1.0) - derivative_splat(2.0) * sig_val));
     }
+    denormal_scope_exit(saved_mxcsr);
 }
 
-double swish(double input_value) {
-    return input_value * sigmoid(input_value);
+/* tanh|x| = -m / (m + 2) with m = expm1(-2|x|), then the sign of x. */
+void tanh_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    derivative_vector input_value;
+    derivative_vector magnitude;
+    derivative_vector tanh_val;
+    derivative_vector first;
+    derivative_mask sign;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i += 2) {
+        input_value = derivative_load(input_array, i, array_length);
+        sign = (derivative_mask)input_value & DERIVATIVE_SIGN_MASK;
+        magnitude = derivative_expm1((derivative_vector)((derivative_mask)input_value & ~sign) * derivative_splat(-2.0));
+        magnitude = -magnitude / (magnitude + derivative_splat(2.0));
+        tanh_val = (derivative_vector)(((derivative_mask)magnitude & ~DERIVATIVE_SIGN_MASK) | sign);
+        first = derivative_splat(1.0) - tanh_val * tanh_val;
+        derivative_store(value_array, i, array_length, tanh_val);
+        derivative_store(first_array, i, array_length, first);
+        derivative_store(second_array, i, array_length, derivative_splat(-2.0) * tanh_val * first);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void elu_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length, double alpha) {
+    unsigned int saved_mxcsr;
+    derivative_vector input_value;
+    derivative_vector negative_part;
+    derivative_vector scaled_exp;
+    derivative_mask positive;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i += 2) {
+        input_value = derivative_load(input_array, i, array_length);
+        positive = (derivative_mask)(input_value > derivative_splat(0.0));
+        negative_part = derivative_splat(alpha) * derivative_expm1(derivative_select(positive, derivative_splat(0.0), input_value));
+        scaled_exp = negative_part + derivative_splat(alpha);
+        derivative_store(value_array, i, array_length, derivative_select(positive, input_value, negative_part));
+        derivative_store(first_array, i, array_length, derivative_select(positive, derivative_splat(1.0), scaled_exp));
+        derivative_store(second_array, i, array_length, derivative_select(positive, derivative_splat(0.0), scaled_exp));
+    }
+    denormal_scope_exit(saved_mxcsr);
 }
-double swish_derivative(double input_value) {
-    double sig_val = sigmoid(input_value);
-    return sig_val + input_value * sig_val * (1.0 - sig_val);
+
+void swish_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    derivative_vector input_value;
+    derivative_vector sig_val;
+    derivative_vector sig_slope;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i += 2) {
+        input_value = derivative_load(input_array, i, array_length);
+        sig_val = derivative_splat(1.0) / (derivative_splat(1.0) + derivative_exp(-input_value));
+        sig_slope = sig_val * (derivative_splat(1.0) - sig_val);
+        derivative_store(value_array, i, array_length, input_value * sig_val);
+        derivative_store(first_array, i, array_length, sig_val + input_value * sig_slope);
+        derivative_store(second_array, i, array_length,
+                         sig_slope * (derivative_splat(2.0) + input_value * (derivative_splat(1.0) - derivative_splat(2.0) * sig_val)));
+    }
+    denormal_scope_exit(saved_mxcsr);
 }
 
+void softplus_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    derivative_vector input_value;
+    derivative_vector exp_of_negative_abs;
+    derivative_vector sig_val;
+    derivative_mask positive;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i += 2) {
+        input_value = derivative_load(input_array, i, array_length);
+        positive = (derivative_mask)(input_value > derivative_splat(0.0));
+        exp_of_negative_abs = derivative_exp((derivative_vector)((derivative_mask)input_value | DERIVATIVE_SIGN_MASK));
+        sig_val = derivative_select(positive, derivative_splat(1.0), exp_of_negative_abs) /
+                  (derivative_splat(1.0) + exp_of_negative_abs);
+        derivative_store(value_array, i, array_length,
+                         derivative_select(positive, input_value, derivative_splat(0.0)) + derivative_log1p_unit(exp_of_negative_abs));
+        derivative_store(first_array, i, array_length, sig_val);
+        derivative_store(second_array, i, array_length, sig_val * (derivative_splat(1.0) - sig_val));
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+/* erf has no polynomial form here, so gelu stays on libm per element. */
+void gelu_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    double input_value;
+    double cdf;
+    double pdf;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        input_value = input_array[i];
+        cdf = 0.5 * (1.0 + erf(input_value * 0.7071067811865476));
+        pdf = 0.3989422804014327 * exp(-0.5 * input_value * input_value);
+        value_array[i] = input_value * cdf;
+        first_array[i] = cdf + input_value * pdf;
+        second_array[i] = pdf * (2.0 - input_value * input_value);
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void sigmoid_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    struct dual_number pair;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = sigmoid_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void tanh_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    struct dual_number pair;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = tanh_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void relu_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    struct dual_number pair;
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = relu_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+}
+
+void leaky_relu_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    struct dual_number pair;
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = leaky_relu_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+}
+
+void hard_sigmoid_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    struct dual_number pair;
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = hard_sigmoid_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+}
+
+void linear_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    struct dual_number pair;
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = linear_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+}
+
+void elu_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length, double alpha) {
+    unsigned int saved_mxcsr;
+    struct dual_number pair;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = elu_dual(pair, alpha);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void swish_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    struct dual_number pair;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = swish_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void softplus_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    struct dual_number pair;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = softplus_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+void gelu_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length) {
+    unsigned int saved_mxcsr;
+    struct dual_number pair;
+    size_t i;
+
+    saved_mxcsr = denormal_scope_enter();
+    for (i = 0; i < array_length; i++) {
+        pair.value = input_array[i];
+        pair.tangent = tangent_array[i];
+        pair = gelu_dual(pair);
+        value_array[i] = pair.value;
+        tangent_output_array[i] = pair.tangent;
+    }
+    denormal_scope_exit(saved_mxcsr);
+}
+
+/* sin and cos of the same argument: Cody-Waite reduction by pi/2 in three
+   parts, then the fdlibm minimax polynomials on [-pi/4, pi/4]. Arguments
+   beyond SINCOS_REDUCTION_LIMIT, or non-finite, go to libm. */
+static void fast_sincos(double input_value, double *sin_out, double *cos_out) {
+    double quadrant_value;
+    double reduced;
+    double reduced_squared;
+    double sin_reduced;
+    double cos_reduced;
+    long quadrant;
+    uint64_t quadrant_bits;
+    uint64_t swap_mask;
+    uint64_t sin_bits;
+    uint64_t cos_bits;
+    uint64_t result_bits;
+
+    if (!(fabs(input_value) < SINCOS_REDUCTION_LIMIT)) {
+        *sin_out = sin(input_value);
+        *cos_out = cos(input_value);
+        return;
+    }
+
+    quadrant_value = (input_value * 6.36619772367581382433e-01 + 6755399441055744.0) - 6755399441055744.0;
+    reduced = input_value - quadrant_value * 1.57079632673412561417e+00;
+    reduced = reduced - quadrant_value * 6.07710050630396597660e-11;
+    reduced = reduced - quadrant_value * 2.02226624871116645580e-21;
+    quadrant = (long)quadrant_value;
+
+    reduced_squared = reduced * reduced;
+    sin_reduced = reduced + reduced * reduced_squared *
+        (-1.66666666666666324348e-01 + reduced_squared *
+         (8.33333333332248946124e-03 + reduced_squared *
+          (-1.98412698298579493134e-04 + reduced_squared *
+           (2.75573137070700676789e-06 + reduced_squared *
+            (-2.50507602534068634195e-08 + reduced_squared * 1.58969099521155010221e-10)))));
+    cos_reduced = 1.0 - 0.5 * reduced_squared + reduced_squared * reduced_squared *
+        (4.16666666666666019037e-02 + reduced_squared *
+         (-1.38888888888741095749e-03 + reduced_squared *
+          (2.48015872894767294178e-05 + reduced_squared *
+           (-2.75573143513906633035e-07 + reduced_squared *
+            (2.08757232129817482790e-09 + reduced_squared * -1.13596475577881948265e-11)))));
+
+    /* Odd quadrants swap sin and cos; sin is negated in quadrants 2 and 3,
+       cos in 1 and 2. Both are applied as bit masks so the loop has no
+       data-dependent branch. */
+    quadrant_bits = (uint64_t)quadrant;
+    swap_mask = (uint64_t)0 - (quadrant_bits & 1);
+    memcpy(&sin_bits, &sin_reduced, sizeof(sin_bits));
+    memcpy(&cos_bits, &cos_reduced, sizeof(cos_bits));
+    result_bits = ((sin_bits & ~swap_mask) | (cos_bits & swap_mask)) ^ ((quadrant_bits & 2) << 62);
+    memcpy(sin_out, &result_bits, sizeof(result_bits));
+    result_bits = ((cos_bits & ~swap_mask) | (sin_bits & swap_mask)) ^ (((quadrant_bits + 1) & 2) << 62);
+    memcpy(cos_out, &result_bits, sizeof(result_bits));
+}
+
+void sine_activation_array(const double *input_array, double *value_array, double *derivative_array, size_t array_length, double omega) {
+    double sin_val;
+    double cos_val;
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        fast_sincos(omega * input_array[i], &sin_val, &cos_val);
+        value_array[i] = sin_val;
+        if (derivative_array != NULL) {
+            derivative_array[i] = omega * cos_val;
+        }
+    }
+}
+
+void cosine_activation_array(const double *input_array, double *value_array, double *derivative_array, size_t array_length, double omega) {
+    double sin_val;
+    double cos_val;
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        fast_sincos(omega * input_array[i], &sin_val, &cos_val);
+        value_array[i] = cos_val;
+        if (derivative_array != NULL) {
+            derivative_array[i] = -omega * sin_val;
+        }
+    }
+}
+
+void maxout_forward(const double *input_array, double *output_array, unsigned char *argmax_array, size_t group_count, size_t piece_count) {
+    double candidate;
+    size_t piece;
+    size_t g;
+
+    for (g = 0; g < group_count; g++) {
+        output_array[g] = input_array[g * piece_count];
+        argmax_array[g] = 0;
+    }
+    for (piece = 1; piece < piece_count; piece++) {
+        for (g = 0; g < group_count; g++) {
+            candidate = input_array[g * piece_count + piece];
+            if (candidate > output_array[g]) {
+                output_array[g] = candidate;
+                argmax_array[g] = (unsigned char)piece;
+            }
+        }
+    }
+}
+
+void maxout_backward(const double *output_grad, const unsigned char *argmax_array, double *input_grad, size_t group_count, size_t piece_count) {
+    size_t i;
+    size_t g;
+
+    for (i = 0; i < group_count * piece_count; i++) {
+        input_grad[i] = 0.0;
+    }
+    for (g = 0; g < group_count; g++) {
+        input_grad[g * piece_count + argmax_array[g]] = output_grad[g];
+    }
+}
+
+size_t relu_csr(size_t *row_offsets, size_t *column_indices, double *values, size_t row_count) {
+    size_t row_start;
+    size_t row_end;
+    size_t count;
+    size_t row;
+    size_t k;
+
+    count = 0;
+    row_start = row_offsets[0];
+    for (row = 0; row < row_count; row++) {
+        row_end = row_offsets[row + 1];
+        row_offsets[row] = count;
+        for (k = row_start; k < row_end; k++) {
+            column_indices[count] = column_indices[k];
+            values[count] = values[k];
+            count += values[k] > 0.0;
+        }
+        row_start = row_end;
+    }
+    row_offsets[row_count] = count;
+    return count;
+}
+
+size_t relu_dense_to_csr(const double *input_array, size_t row_count, size_t column_count, size_t *row_offsets, size_t *column_indices, double *values) {
+    const double *row_values;
+    size_t count;
+    size_t row;
+    size_t column;
+
+    count = 0;
+    for (row = 0; row < row_count; row++) {
+        row_offsets[row] = count;
+        row_values = input_array + row * column_count;
+        for (column = 0; column < column_count; column++) {
+            column_indices[count] = column;
+            values[count] = row_values[column];
+            count += row_values[column] > 0.0;
+        }
+    }
+    row_offsets[row_count] = count;
+    return count;
+}
+
+void relu_backward_csr(const size_t *row_offsets, const size_t *column_indices, size_t row_count, size_t column_count, const double *output_grad, double *input_grad_values) {
+    const double *grad_row;
+    size_t row;
+    size_t k;
+
+    for (row = 0; row < row_count; row++) {
+        grad_row = output_grad + row * column_count;
+        for (k = row_offsets[row]; k < row_offsets[row + 1]; k++) {
+            input_grad_values[k] = grad_row[column_indices[k]];
+        }
+    }
+}
+
+void activation_stats_collect(const double *input_array, size_t array_length, struct activation_stats *stats) {
+    size_t relu_zero_count;
+    size_t saturated_count;
+    size_t linear_count;
+    size_t nan_count;
+    double input_value;
+    size_t i;
+
+    relu_zero_count = 0;
+    saturated_count = 0;
+    linear_count = 0;
+    nan_count = 0;
+    for (i = 0; i < array_length; i++) {
+        input_value = input_array[i];
+        relu_zero_count += !(input_value > 0.0);
+        saturated_count += fabs(input_value) > 20.0;
+        linear_count += fabs(input_value) <= 2.5;
+        nan_count += input_value != input_value;
+    }
+    stats->element_count += array_length;
+    stats->relu_zero_count += relu_zero_count;
+    stats->sigmoid_saturated_count += saturated_count;
+    stats->hard_sigmoid_linear_count += linear_count;
+    stats->nan_count += nan_count;
+}
+
+void activation_stats_merge(struct activation_stats *total, const struct activation_stats *stats) {
+    total->element_count += stats->element_count;
+    total->relu_zero_count += stats->relu_zero_count;
+    total->sigmoid_saturated_count += stats->sigmoid_saturated_count;
+    total->hard_sigmoid_linear_count += stats->hard_sigmoid_linear_count;
+    total->nan_count += stats->nan_count;
+}
+
+void relu_array_stats(const double *input_array, double *output_array, size_t array_length, struct activation_stats *stats) {
+    size_t block_length;
+    size_t start;
+
+    for (start = 0; start < array_length; start += STATS_BLOCK_LENGTH) {
+        block_length = array_length - start;
+        if (block_length > STATS_BLOCK_LENGTH) {
+            block_length = STATS_BLOCK_LENGTH;
+        }
+        activation_stats_collect(input_array + start, block_length, stats);
+        relu_array(input_array + start, output_array + start, block_length);
+    }
+}
+
+void sigmoid_array_stats(const double *input_array, double *output_array, size_t array_length, struct activation_stats *stats) {
+    size_t block_length;
+    size_t start;
+
+    for (start = 0; start < array_length; start += STATS_BLOCK_LENGTH) {
+        block_length = array_length - start;
+        if (block_length > STATS_BLOCK_LENGTH) {
+            block_length = STATS_BLOCK_LENGTH;
+        }
+        activation_stats_collect(input_array + start, block_length, stats);
+        sigmoid_array(input_array + start, output_array + start, block_length);
+    }
+}
+
+void hard_sigmoid_array_stats(const double *input_array, double *output_array, size_t array_length, struct activation_stats *stats) {
+    size_t block_length;
+    size_t start;
+
+    for (start = 0; start < array_length; start += STATS_BLOCK_LENGTH) {
+        block_length = array_length - start;
+        if (block_length > STATS_BLOCK_LENGTH) {
+            block_length = STATS_BLOCK_LENGTH;
+        }
+        activation_stats_collect(input_array + start, block_length, stats);
+        hard_sigmoid_array(input_array + start, output_array + start, block_length);
+    }
+}
@@ -0,0 +1,766 @@
+#ifndef NN_FUNC_H
+#define NN_FUNC_H
+
+#include <math.h>
+#include <stddef.h>
+
+#define NN_FUNC_VERSION_MAJOR 1
+#define NN_FUNC_VERSION_MINOR 0
+
+#if defined(NN_FUNC_BUILD) && defined(__GNUC__)
+#define NN_FUNC_API __attribute__((visibility("default")))
+#else
+#define NN_FUNC_API
+#endif
+
+#if !defined(NN_FUNC_NO_INLINE) && (defined(__cplusplus) || \
+    (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L && !defined(__GNUC_GNU_INLINE__)))
+#define NN_FUNC_HAS_INLINE 1
+#define NN_FUNC_INLINE inline
+#else
+#define NN_FUNC_INLINE
+#endif
+
+#if defined(__GNUC__)
+#define NN_FUNC_CONST __attribute__((const))
+#else
+#define NN_FUNC_CONST
+#endif
+
+#if defined(NN_FUNC_HAS_INLINE) && defined(__cplusplus) && __cplusplus >= 201402L
+#define NN_FUNC_CONSTEXPR constexpr
+#else
+#define NN_FUNC_CONSTEXPR NN_FUNC_INLINE
+#endif
+
+/* Constant-expression forms of the piecewise-linear activations, usable in
+   static initializers. Arguments are evaluated more than once. */
+#define NN_RELU(x) ((x) > 0.0 ? (x) : 0.0)
+#define NN_RELU_DERIVATIVE(x) ((x) > 0.0 ? 1.0 : 0.0)
+#define NN_LEAKY_RELU(x) ((x) > 0.0 ? (x) : 0.01 * (x))
+#define NN_LEAKY_RELU_DERIVATIVE(x, alpha) ((x) > 0.0 ? 1.0 : (alpha))
+#define NN_HARD_SIGMOID(x) \
+    (0.2 * (x) + 0.5 < 0.0 ? 0.0 : (0.2 * (x) + 0.5 > 1.0 ? 1.0 : 0.2 * (x) + 0.5))
+#define NN_HARD_SIGMOID_DERIVATIVE(x) ((x) < -2.5 || (x) > 2.5 ? 0.0 : 0.2)
+#define NN_LINEAR(x) (x)
+#define NN_LINEAR_DERIVATIVE(x) (1.0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double sigmoid(double input_value);
+NN_FUNC_API double sigmoid_error_handl(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double sigmoid_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double tanh_activation(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double tanh_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_CONSTEXPR double relu(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_CONSTEXPR double relu_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_CONSTEXPR double leaky_relu(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_CONSTEXPR double leay_derivative(double input_value, double alpha);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_CONSTEXPR double hard_sigmoid(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_CONSTEXPR double hard_sigmoid_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_CONSTEXPR double linear(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_CONSTEXPR double linear_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double elu(double input_value, double alpha);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double elu_derivative(double input_value, double alpha);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double swish(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double swish_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double softplus(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double softplus_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double gelu(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double gelu_derivative(double input_value);
+
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double sigmoid_second_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double tanh_second_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double elu_second_derivative(double input_value, double alpha);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double swish_second_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double softplus_second_derivative(double input_value);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double gelu_second_derivative(double input_value);
+
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double sine_activation(double input_value, double omega);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double sine_derivative(double input_value, double omega);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double cosine_activation(double input_value, double omega);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE double cosine_derivative(double input_value, double omega);
+
+NN_FUNC_API void softmax(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void softmax_rows(const double *input_array, double *output_array, size_t row_count, size_t row_length);
+
+NN_FUNC_API void sigmoid_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void sigmoid_derivative_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void tanh_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void tanh_derivative_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void relu_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void relu_derivative_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void leaky_relu_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void leaky_relu_derivative_array(const double *input_array, double *output_array, size_t array_length, double alpha);
+NN_FUNC_API void hard_sigmoid_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void hard_sigmoid_derivative_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void elu_array(const double *input_array, double *output_array, size_t array_length, double alpha);
+NN_FUNC_API void elu_derivative_array(const double *input_array, double *output_array, size_t array_length, double alpha);
+NN_FUNC_API void swish_array(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void swish_derivative_array(const double *input_array, double *output_array, size_t array_length);
+
+/* relu, leaky_relu, elu and their derivative arrays work on blocks of 64
+   doubles (512 bytes): blocks that are entirely positive are copied (or left
+   alone in place) or filled, entirely non-positive blocks take the negative
+   branch without a per-element select. Runs of mixed blocks are only sampled,
+   so blocks taken on trust count as mixed. The counters are per thread and
+   cumulative. */
+struct block_path_stats {
+    size_t positive_blocks;
+    size_t negative_blocks;
+    size_t mixed_blocks;
+};
+
+NN_FUNC_API void block_path_stats_get(struct block_path_stats *stats);
+NN_FUNC_API void block_path_stats_reset(void);
+
+/* Memoised sigmoid and tanh for inputs that repeat, such as quantised
+   embeddings. Each thread has a direct-mapped table per function (512 entries,
+   keyed on the input bit pattern) that stays in L1. After each window of 4096
+   lookups a table disables itself for the thread if fewer than a quarter
+   hit, and retries after 1M bypassed elements; the sigmoid and tanh tables
+   decide this separately. Results are identical to sigmoid_array and
+   tanh_array. */
+struct activation_cache_stats {
+    size_t lookups;
+    size_t hits;
+    size_t bypassed;
+    int enabled;
+};
+
+NN_FUNC_API void sigmoid_array_cached(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void tanh_array_cached(const double *input_array, double *output_array, size_t array_length);
+NN_FUNC_API void activation_cache_stats_get(struct activation_cache_stats *sigmoid_stats, struct activation_cache_stats *tanh_stats);
+NN_FUNC_API void activation_cache_reset(void);
+
+/* When enabled for the calling thread, the exp-based array kernels run with
+   flush-to-zero and denormals-are-zero set in MXCSR, and restore the caller's
+   MXCSR on return. They are: the plain and strided sigmoid, tanh, elu and
+   swish arrays and their derivative arrays; the sigmoid, tanh, elu, swish,
+   softplus and gelu *_derivatives_array and *_jvp_array kernels; the cached
+   sigmoid and tanh arrays; softmax, softmax_rows and the incremental
+   softmax. The scalar functions, the other array kernels and the layer
+   functions run under the caller's MXCSR.
+   Results that would be denormal become zero, and denormal inputs are read as
+   zero. Disabled by default; a no-op on targets without SSE. thread_pool_run
+   applies the caller's setting to its tasks, and coalescer_submit only
+   batches calls made with the same setting, so parallel and coalesced calls
+   flush exactly when a direct call from the caller would. */
+NN_FUNC_API void denormal_flush_set(int enabled);
+NN_FUNC_API int denormal_flush_get(void);
+
+NN_FUNC_API void sigmoid_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void sigmoid_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void tanh_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void tanh_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void relu_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void relu_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void leaky_relu_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void leaky_relu_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length, double alpha);
+NN_FUNC_API void hard_sigmoid_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void hard_sigmoid_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void elu_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length, double alpha);
+NN_FUNC_API void elu_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length, double alpha);
+NN_FUNC_API void swish_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+NN_FUNC_API void swish_derivative_array_strided(const double *input_array, ptrdiff_t input_stride, double *output_array, ptrdiff_t output_stride, size_t array_length);
+
+/* f(x), f'(x) and f''(x) in one pass, sharing one exp per element. All but
+   gelu evaluate two elements at a time with a polynomial exp; gelu calls
+   libm erf per element. */
+NN_FUNC_API void sigmoid_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length);
+NN_FUNC_API void tanh_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length);
+NN_FUNC_API void elu_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length, double alpha);
+NN_FUNC_API void swish_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length);
+NN_FUNC_API void softplus_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length);
+NN_FUNC_API void gelu_derivatives_array(const double *input_array, double *value_array, double *first_array, double *second_array, size_t array_length);
+
+/* sin(omega * x) and cos(omega * x) with their derivatives from one shared
+   range reduction; derivative_array may be NULL. */
+NN_FUNC_API void sine_activation_array(const double *input_array, double *value_array, double *derivative_array, size_t array_length, double omega);
+NN_FUNC_API void cosine_activation_array(const double *input_array, double *value_array, double *derivative_array, size_t array_length, double omega);
+
+/* Maxout over group_count groups of piece_count contiguous inputs
+   (1 <= piece_count <= 256). argmax_array receives the winning piece of each
+   group, which the backward pass scatters through without the inputs. */
+NN_FUNC_API void maxout_forward(const double *input_array, double *output_array, unsigned char *argmax_array, size_t group_count, size_t piece_count);
+NN_FUNC_API void maxout_backward(const double *output_grad, const unsigned char *argmax_array, double *input_grad, size_t group_count, size_t piece_count);
+
+/* Sparse ReLU on CSR matrices (row_offsets has row_count + 1 entries).
+   relu_csr drops non-positive entries in place and returns the new
+   nonzero count. relu_dense_to_csr keeps only the positive entries of a
+   dense row-major matrix; column_indices and values must have room for
+   row_count * column_count entries. relu_backward_csr gathers the dense
+   output gradient at the stored positions, the only places where the ReLU
+   derivative is non-zero. */
+NN_FUNC_API size_t relu_csr(size_t *row_offsets, size_t *column_indices, double *values, size_t row_count);
+NN_FUNC_API size_t relu_dense_to_csr(const double *input_array, size_t row_count, size_t column_count, size_t *row_offsets, size_t *column_indices, double *values);
+NN_FUNC_API void relu_backward_csr(const size_t *row_offsets, const size_t *column_indices, size_t row_count, size_t column_count, const double *output_grad, double *input_grad_values);
+
+/* Input statistics that tell whether sparse or table-driven paths would pay
+   off: elements relu maps to zero, elements past the +/-20 saturation bounds
+   of sigmoid_error_handl, elements in the linear region of hard_sigmoid, and
+   NaNs. Counters are added to, so one struct can aggregate many calls. The
+   *_array_stats kernels count each L1-sized block just before computing it. */
+struct activation_stats {
+    size_t element_count;
+    size_t relu_zero_count;
+    size_t sigmoid_saturated_count;
+    size_t hard_sigmoid_linear_count;
+    size_t nan_count;
+};
+
+NN_FUNC_API void activation_stats_collect(const double *input_array, size_t array_length, struct activation_stats *stats);
+NN_FUNC_API void activation_stats_merge(struct activation_stats *total, const struct activation_stats *stats);
+NN_FUNC_API void relu_array_stats(const double *input_array, double *output_array, size_t array_length, struct activation_stats *stats);
+NN_FUNC_API void sigmoid_array_stats(const double *input_array, double *output_array, size_t array_length, struct activation_stats *stats);
+NN_FUNC_API void hard_sigmoid_array_stats(const double *input_array, double *output_array, size_t array_length, struct activation_stats *stats);
+
+typedef double (*activation_function)(double input_value);
+
+/* Incremental re-evaluation when only the inputs listed in dirty_indices have
+   changed since the last call. Both fall back to a full pass when more than a
+   quarter of the array is dirty. The softmax keeps the unnormalised
+   exponentials in exp_values (array_length doubles owned by the caller) and
+   their shift, sum and the largest sum since the last full pass in the state;
+   softmax_incremental_init must be called first. An update recomputes exp() only for dirty elements, but still
+   rescales every output. */
+struct softmax_state {
+    double shift;
+    double sum_exp;
+    double peak_sum;
+};
+
+NN_FUNC_API void activation_array_update(activation_function activation, const double *input_array, double *output_array, size_t array_length, const size_t *dirty_indices, size_t dirty_count);
+NN_FUNC_API void softmax_incremental_init(const double *input_array, double *exp_values, double *output_array, size_t array_length, struct softmax_state *state);
+NN_FUNC_API void softmax_incremental_update(const double *input_array, double *exp_values, double *output_array, size_t array_length, const size_t *dirty_indices, size_t dirty_count, struct softmax_state *state);
+
+/* Weights are input_size x output_size, row-major. A NULL activation is the
+   identity. pre_activation may be NULL when the backward pass is not needed. */
+struct dense_layer {
+    const double *weights;
+    const double *bias;
+    size_t input_size;
+    size_t output_size;
+    activation_function activation;
+};
+
+NN_FUNC_API void dense_forward(const double *weights, const double *bias, const double *input,
+                               double *pre_activation, double *output, size_t batch_size,
+                               size_t input_size, size_t output_size, activation_function activation);
+NN_FUNC_API size_t mlp_scratch_length(const struct dense_layer *layers, size_t layer_count, size_t batch_size);
+NN_FUNC_API void mlp_forward(const struct dense_layer *layers, size_t layer_count, const double *input,
+                             double *output, size_t batch_size, double *scratch);
+
+/* delta receives output_grad * activation_derivative(pre_activation) and may
+   alias output_grad. Gradients are overwritten, not accumulated. input_grad
+   may be NULL for the first layer. The derivatives of relu, sigmoid,
+   tanh_activation, hard_sigmoid and swish run as their *_derivative_array
+   kernels. */
+NN_FUNC_API void dense_backward(const double *weights, const double *input, const double *pre_activation,
+                                const double *output_grad, double *delta, double *weight_grad, double *bias_grad,
+                                double *input_grad, size_t batch_size, size_t input_size, size_t output_size,
+                                activation_function activation_derivative);
+NN_FUNC_API void sgd_update(double *params, const double *grads, size_t count, double learning_rate);
+/* step counts updates from 1; a step below 1 leaves everything unchanged. */
+NN_FUNC_API void adam_update(double *params, const double *grads, double *first_moment, double *second_moment,
+                             size_t count, int step, double learning_rate, double beta1, double beta2,
+                             double epsilon);
+
+struct thread_pool;
+typedef void (*thread_pool_task)(void *argument);
+
+/* thread_pool_run blocks until every task has finished. A NULL pool runs the
+   tasks on the calling thread. */
+NN_FUNC_API struct thread_pool *thread_pool_create(int thread_count);
+NN_FUNC_API void thread_pool_destroy(struct thread_pool *pool);
+NN_FUNC_API int thread_pool_size(const struct thread_pool *pool);
+NN_FUNC_API void thread_pool_run(struct thread_pool *pool, thread_pool_task task, void **arguments, int task_count);
+
+/* Request coalescing for many small calls from many threads. Submissions
+   that arrive within budget_seconds of the first one in a batch are copied
+   into one buffer of up to max_batch_elements, run as a single kernel call
+   (split across the pool when it is large; pool may be NULL), and the
+   results are copied back. A batch also closes early when it is full. Each
+   submission blocks until its own results are written. Submissions longer
+   than max_batch_elements run alone, straight from the caller's buffers.
+   A softmax batch whose rows all have the same length runs as one
+   softmax_rows call; otherwise each row is its own softmax call.
+   input and output may alias. coalescer_create returns NULL on failure or
+   for a kernel outside the enum, and no submission may be in flight in
+   coalescer_destroy. */
+enum coalesce_kernel {
+    COALESCE_SIGMOID,
+    COALESCE_TANH,
+    COALESCE_RELU,
+    COALESCE_LEAKY_RELU,
+    COALESCE_HARD_SIGMOID,
+    COALESCE_SWISH,
+    COALESCE_SOFTMAX
+};
+
+/* Batch sizes count submissions and elements per kernel call. Latency runs
+   from entry to return of coalescer_submit, so it includes the copies and the
+   batched kernel call as well as the wait for the batch to close. */
+struct coalescer_stats {
+    size_t submissions;
+    size_t batches;
+    size_t batch_submissions_p50;
+    size_t batch_submissions_p99;
+    size_t batch_submissions_max;
+    size_t batch_elements_p50;
+    size_t batch_elements_max;
+    double latency_p50_seconds;
+    double latency_p99_seconds;
+    double latency_p999_seconds;
+    double latency_max_seconds;
+};
+
+struct coalescer;
+
+NN_FUNC_API struct coalescer *coalescer_create(enum coalesce_kernel kernel, struct thread_pool *pool,
+                                               size_t max_batch_elements, double budget_seconds);
+NN_FUNC_API void coalescer_destroy(struct coalescer *coalescer);
+NN_FUNC_API void coalescer_submit(struct coalescer *coalescer, const double *input, double *output, size_t length);
+NN_FUNC_API void coalescer_stats_get(struct coalescer *coalescer, struct coalescer_stats *stats);
+
+/* Local activation service for several processes on one host (Linux only;
+   elsewhere start and connect return NULL). activation_service_start listens
+   on a Unix-domain socket and runs every connection's requests through one
+   coalescer per kernel, so small requests from different processes share
+   kernel calls. A client maps a sealed memfd of capacity doubles, shares it
+   with the service when it connects, writes its inputs into
+   activation_client_buffer and names them by offset; the service computes
+   straight out of and into that mapping. activation_client_run returns -1
+   if either range leaves the buffer or the ranges partly overlap. A client
+   handles one request at a time; use one client per thread. Each client
+   holds one service thread, up to 256 at a time; further connections are
+   closed. Starting fails if another service answers on socket_path or the
+   path is not a socket. Stopping the service disconnects its clients. */
+struct activation_service;
+struct activation_client;
+
+NN_FUNC_API struct activation_service *activation_service_start(const char *socket_path, struct thread_pool *pool,
+                                                                size_t max_batch_elements, double budget_seconds);
+NN_FUNC_API void activation_service_stop(struct activation_service *service);
+NN_FUNC_API int activation_service_stats_get(struct activation_service *service, enum coalesce_kernel kernel,
+                                             struct coalescer_stats *stats);
+NN_FUNC_API struct activation_client *activation_client_connect(const char *socket_path, size_t capacity);
+NN_FUNC_API double *activation_client_buffer(struct activation_client *client);
+NN_FUNC_API int activation_client_run(struct activation_client *client, enum coalesce_kernel kernel,
+                                      size_t input_offset, size_t output_offset, size_t length);
+NN_FUNC_API void activation_client_close(struct activation_client *client);
+
+enum gradient_reduction {
+    GRADIENT_REDUCTION_TREE,
+    GRADIENT_REDUCTION_ATOMIC
+};
+
+/* Splits the batch into one shard per pool thread. TREE sums the per-shard
+   gradients pairwise; ATOMIC adds them into weight_grad and bias_grad with
+   lock-free compare-and-swap as each shard finishes. */
+NN_FUNC_API void dense_backward_parallel(struct thread_pool *pool, enum gradient_reduction reduction,
+                                         const double *weights, const double *input, const double *pre_activation,
+                                         const double *output_grad, double *delta, double *weight_grad,
+                                         double *bias_grad, double *input_grad, size_t batch_size,
+                                         size_t input_size, size_t output_size,
+                                         activation_function activation_derivative);
+
+/* Forward-mode (value, tangent) pairs. Compose the scalar forms in one loop to
+   push a tangent through a chain of activations in a single pass. */
+struct dual_number {
+    double value;
+    double tangent;
+};
+
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number sigmoid_dual(struct dual_number input);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number tanh_dual(struct dual_number input);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number relu_dual(struct dual_number input);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number leaky_relu_dual(struct dual_number input);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number hard_sigmoid_dual(struct dual_number input);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number linear_dual(struct dual_number input);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number elu_dual(struct dual_number input, double alpha);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number swish_dual(struct dual_number input);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number softplus_dual(struct dual_number input);
+NN_FUNC_API NN_FUNC_CONST NN_FUNC_INLINE struct dual_number gelu_dual(struct dual_number input);
+
+/* value_array may alias input_array and tangent_output_array may alias
+   tangent_array. */
+NN_FUNC_API void sigmoid_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+NN_FUNC_API void tanh_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+NN_FUNC_API void relu_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+NN_FUNC_API void leaky_relu_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+NN_FUNC_API void hard_sigmoid_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+NN_FUNC_API void linear_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+NN_FUNC_API void elu_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length, double alpha);
+NN_FUNC_API void swish_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+NN_FUNC_API void softplus_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+NN_FUNC_API void gelu_jvp_array(const double *input_array, const double *tangent_array, double *value_array, double *tangent_output_array, size_t array_length);
+
+/* Learnable Pade activation unit P(x) / (1 + |b1 x + ... + bn x^n|).
+   numerator holds numerator_degree + 1 coefficients a0..am, denominator holds
+   denominator_degree coefficients b1..bn. */
+struct rational_activation {
+    double *numerator;
+    double *denominator;
+    int numerator_degree;
+    int denominator_degree;
+};
+
+NN_FUNC_API void rational_forward(const struct rational_activation *activation, const double *input_array,
+                                  double *output_array, size_t array_length);
+/* Coefficient gradients are overwritten with the sum over the array;
+   input_grad may be NULL. */
+NN_FUNC_API void rational_backward(const struct rational_activation *activation, const double *input_array,
+                                   const double *output_grad, double *input_grad, double *numerator_grad,
+                                   double *denominator_grad, size_t array_length);
+NN_FUNC_API void rational_backward_parallel(struct thread_pool *pool, const struct rational_activation *activation,
+                                            const double *input_array, const double *output_grad, double *input_grad,
+                                            double *numerator_grad, double *denominator_grad, size_t array_length);
+/* Fits the coefficients to target on [low, high] and returns the maximum
+   absolute error on the fitting grid, or a negative value on failure. */
+NN_FUNC_API double rational_fit(struct rational_activation *activation, activation_function target,
+                                double low, double high);
+
+enum spline_kind {
+    SPLINE_LINEAR,
+    SPLINE_CUBIC
+};
+
+/* Learnable activation on a uniform grid over [low, high]. SPLINE_LINEAR
+   interpolates between value_count knots; SPLINE_CUBIC treats values as the
+   control points of a uniform cubic B-spline (value_count >= 4). Inputs
+   outside the grid are clamped to its ends. A NaN input gives a NaN output
+   and zero gradients. */
+struct spline_activation {
+    double *values;
+    size_t value_count;
+    double low;
+    double high;
+    enum spline_kind kind;
+};
+
+NN_FUNC_API void spline_forward(const struct spline_activation *activation, const double *input_array,
+                                double *output_array, size_t array_length);
+/* value_grad is overwritten with the sum over the array; input_grad may be NULL. */
+NN_FUNC_API void spline_backward(const struct spline_activation *activation, const double *input_array,
+                                 const double *output_grad, double *input_grad, double *value_grad,
+                                 size_t array_length);
+NN_FUNC_API void spline_backward_parallel(struct thread_pool *pool, const struct spline_activation *activation,
+                                          const double *input_array, const double *output_grad, double *input_grad,
+                                          double *value_grad, size_t array_length);
+/* Initialises the values by sampling target at the knots. */
+NN_FUNC_API void spline_fit(struct spline_activation *activation, activation_function target);
+
+/* Tracing of the batched kernels, dense layers and thread-pool tasks, written
+   as Chrome trace-event JSON for chrome://tracing or Perfetto. Only compiled in
+   when the library is built with -DNN_FUNC_TRACE (make TRACE=1); otherwise
+   trace_enable does nothing and trace_write_json returns -1. Each thread
+   records into its own buffer without locking. trace_write_json writes and
+   clears every buffer, so call it while no kernels are running. */
+NN_FUNC_API void trace_enable(int enabled);
+NN_FUNC_API int trace_write_json(const char *path);
+
+/* Runtime metrics: per-kernel calls, elements, NaN outputs and a latency
+   histogram, plus thread-pool queue depth. Collection is off until
+   metrics_enable(1) or metrics_export_start; a disabled kernel pays one
+   relaxed load. Each thread counts into its own shard. metrics_write_prometheus
+   writes the Prometheus text format to path + ".tmp" and renames it over path,
+   so a node_exporter textfile collector never reads a partial file.
+   metrics_export_start does that every interval_seconds from a background
+   thread and enables collection; metrics_export_stop writes once more and
+   joins it. */
+NN_FUNC_API void metrics_enable(int enabled);
+NN_FUNC_API int metrics_write_prometheus(const char *path);
+NN_FUNC_API int metrics_export_start(const char *path, double interval_seconds);
+NN_FUNC_API void metrics_export_stop(void);
+
+#ifdef NN_FUNC_HAS_INLINE
+
+NN_FUNC_INLINE double sigmoid(double input_value) {
+    double negative_input;
+    double exp_of_negative;
+    double denominator;
+    double sigmoid_result;
+    negative_input = input_value * -1.0;
+    exp_of_negative = exp(negative_input);
+    denominator = 1.0 + exp_of_negative;
+    sigmoid_result = 1.0 / denominator;
+    return sigmoid_result;
+}
+
+NN_FUNC_INLINE double sigmoid_derivative(double input_value) {
+    double sig_val = sigmoid(input_value);
+    return sig_val * (1.0 - sig_val);
+}
+
+NN_FUNC_INLINE double tanh_activation(double input_value) {
+    double tanh_result;
+    tanh_result = tanh(input_value);
+    return tanh_result;
+
+}
+
+NN_FUNC_INLINE double tanh_derivative(double input_value) {
+    double tanh_val;
+    double tanh_squared;
+    double derivative_result;
+
+    tanh_val = tanh_activation(input_value);
+
+    tanh_squared = tanh_val * tanh_val;
+    derivative_result = 1.0 - tanh_squared;
+    
+    return derivative_result;
+}
+
+NN_FUNC_CONSTEXPR double relu(double input_value) {
+    if (input_value > 0.0) {
+        return input_value;
+    } else {
+        return 0.0;
+    }
+}
+
+NN_FUNC_CONSTEXPR double relu_derivative(double input_value) {
+    if (input_value > 0.0) {
+        return 1.0;
+    } else {
+        return 0.0;
+    }
+}
+
+NN_FUNC_CONSTEXPR double leaky_relu(double input_value) {
+    double alpha = 0.01;
+    if (input_value > 0.0) {
+        return input_value;
+    } else {
+        return alpha * input_value;
+    }
+}
+
+NN_FUNC_CONSTEXPR double leay_derivative(double input_value, double alpha) {
+    if (input_value > 0.0) {
+        return 1.0;
+    } else {
+        return alpha;
+    }
+}
+
+NN_FUNC_CONSTEXPR double hard_sigmoid(double input_value) {
+    double result  = 0.2 * input_value + 0.5;
+    if (result < 0.0) {
+        return 0.0;
+    } else if (result > 1.0) {
+        return 1.0;
+    } else {
+        return result;
+    }
+}
+
+NN_FUNC_CONSTEXPR double hard_sigmoid_derivative(double input_value) {
+    if (input_value < -2.5 || input_value > 2.5) {
+        return 0.0;
+    } else {
+        return 0.2;
+    }
+}
+
+NN_FUNC_CONSTEXPR double linear(double input_value) {
+    return input_value;
+}
+
+NN_FUNC_CONSTEXPR double linear_derivative(double input_value) {
+    (void)input_value;
+    return 1.0;
+}
+
+NN_FUNC_INLINE double elu(double input_value, double alpha) {
+    if (input_value > 0.0) {
+        return input_value;
+    } else {
+        return alpha * (exp(input_value) - 1.0);
+    }
+}
+
+NN_FUNC_INLINE double elu_derivative(double input_value, double alpha) {
+    if (input_value > 0.0) {
+        return 1.0;
+    } else {
+        return elu(input_value, alpha) + alpha;
+    }
+}
+
+NN_FUNC_INLINE double swish(double input_value) {
+    return input_value * sigmoid(input_value);
+}
+
+NN_FUNC_INLINE double swish_derivative(double input_value) {
+    double sig_val = sigmoid(input_value);
+    return sig_val + input_value * sig_val * (1.0 - sig_val);
+}
+
+NN_FUNC_INLINE double softplus(double input_value) {
+    if (input_value > 0.0) {
+        return input_value + log1p(exp(-input_value));
+    } else {
+        return log1p(exp(input_value));
+    }
+}
+
+NN_FUNC_INLINE double softplus_derivative(double input_value) {
+    return sigmoid(input_value);
+}
+
+NN_FUNC_INLINE double gelu(double input_value) {
+    return 0.5 * input_value * (1.0 + erf(input_value * 0.7071067811865476));
+}
+
+NN_FUNC_INLINE double gelu_derivative(double input_value) {
+    double cdf = 0.5 * (1.0 + erf(input_value * 0.7071067811865476));
+    double pdf = 0.3989422804014327 * exp(-0.5 * input_value * input_value);
+    return cdf + input_value * pdf;
+}
+
+NN_FUNC_INLINE double sigmoid_second_derivative(double input_value) {
+    double sig_val = sigmoid(input_value);
+    return sig_val * (1.0 - sig_val) * (1.0 - 2.0 * sig_val);
+}
+
+NN_FUNC_INLINE double tanh_second_derivative(double input_value) {
+    double tanh_val = tanh_activation(input_value);
+    return -2.0 * tanh_val * (1.0 - tanh_val * tanh_val);
+}
+
+NN_FUNC_INLINE double elu_second_derivative(double input_value, double alpha) {
+    if (input_value > 0.0) {
+        return 0.0;
+    } else {
+        return alpha * exp(input_value);
+    }
+}
+
+NN_FUNC_INLINE double swish_second_derivative(double input_value) {
+    double sig_val = sigmoid(input_value);
+    return sig_val * (1.0 - sig_val) * (2.0 + input_value * (1.0 - 2.0 * sig_val));
+}
+
+NN_FUNC_INLINE double softplus_second_derivative(double input_value) {
+    return sigmoid_derivative(input_value);
+}
+
+NN_FUNC_INLINE double gelu_second_derivative(double input_value) {
+    double pdf = 0.3989422804014327 * exp(-0.5 * input_value * input_value);
+    return pdf * (2.0 - input_value * input_value);
+}
+
+NN_FUNC_INLINE double sine_activation(double input_value, double omega) {
+    return sin(omega * input_value);
+}
+
+NN_FUNC_INLINE double sine_derivative(double input_value, double omega) {
+    return omega * cos(omega * input_value);
+}
+
+NN_FUNC_INLINE double cosine_activation(double input_value, double omega) {
+    return cos(omega * input_value);
+}
+
+NN_FUNC_INLINE double cosine_derivative(double input_value, double omega) {
+    return -omega * sin(omega * input_value);
+}
+
+NN_FUNC_INLINE struct dual_number sigmoid_dual(struct dual_number input) {
+    struct dual_number output;
+    double sig_val = sigmoid(input.value);
+    output.value = sig_val;
+    output.tangent = input.tangent * sig_val * (1.0 - sig_val);
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number tanh_dual(struct dual_number input) {
+    struct dual_number output;
+    double tanh_val = tanh_activation(input.value);
+    output.value = tanh_val;
+    output.tangent = input.tangent * (1.0 - tanh_val * tanh_val);
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number relu_dual(struct dual_number input) {
+    struct dual_number output;
+    output.value = relu(input.value);
+    output.tangent = input.tangent * relu_derivative(input.value);
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number leaky_relu_dual(struct dual_number input) {
+    struct dual_number output;
+    output.value = leaky_relu(input.value);
+    output.tangent = input.tangent * leay_derivative(input.value, 0.01);
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number hard_sigmoid_dual(struct dual_number input) {
+    struct dual_number output;
+    output.value = hard_sigmoid(input.value);
+    output.tangent = input.tangent * hard_sigmoid_derivative(input.value);
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number linear_dual(struct dual_number input) {
+    struct dual_number output;
+    output = input;
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number elu_dual(struct dual_number input, double alpha) {
+    struct dual_number output;
+    double scaled_exp;
+    if (input.value > 0.0) {
+        output = input;
+    } else {
+        scaled_exp = alpha * exp(input.value);
+        output.value = scaled_exp - alpha;
+        output.tangent = input.tangent * scaled_exp;
+    }
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number swish_dual(struct dual_number input) {
+    struct dual_number output;
+    double sig_val = sigmoid(input.value);
+    output.value = input.value * sig_val;
+    output.tangent = input.tangent * (sig_val + input.value * sig_val * (1.0 - sig_val));
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number softplus_dual(struct dual_number input) {
+    struct dual_number output;
+    double exp_of_negative_abs = exp(-fabs(input.value));
+    if (input.value > 0.0) {
+        output.value = input.value + log1p(exp_of_negative_abs);
+        output.tangent = input.tangent / (1.0 + exp_of_negative_abs);
+    } else {
+        output.value = log1p(exp_of_negative_abs);
+        output.tangent = input.tangent * exp_of_negative_abs / (1.0 + exp_of_negative_abs);
+    }
+    return output;
+}
+
+NN_FUNC_INLINE struct dual_number gelu_dual(struct dual_number input) {
+    struct dual_number output;
+    double cdf = 0.5 * (1.0 + erf(input.value * 0.7071067811865476));
+    double pdf = 0.3989422804014327 * exp(-0.5 * input.value * input.value);
+    output.value = input.value * cdf;
+    output.tangent = input.tangent * (cdf + input.value * pdf);
+    return output;
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "nn_histogram.h"
+
+static int histogram_index(uint64_t value) {
+    int shift;
+
+    if (value < HISTOGRAM_EXACT_LIMIT) {
+        return (int)value;
+    }
+    shift = 0;
+    while ((value >> shift) >= HISTOGRAM_EXACT_LIMIT) {
+        shift++;
+    }
+    return HISTOGRAM_EXACT_LIMIT + (shift - 1) * HISTOGRAM_SUB_BUCKETS +
+           (int)(value >> shift) - HISTOGRAM_SUB_BUCKETS;
+}
+
+static uint64_t histogram_bucket_high(int index) {
+    int shift;
+    uint64_t sub_bucket;
+
+    if (index < HISTOGRAM_EXACT_LIMIT) {
+        return (uint64_t)index;
+    }
+    shift = (index - HISTOGRAM_EXACT_LIMIT) / HISTOGRAM_SUB_BUCKETS + 1;
+    sub_bucket = (uint64_t)((index - HISTOGRAM_EXACT_LIMIT) % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS);
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void histogram_record(struct histogram *histogram, uint64_t value) {
+    histogram->counts[histogram_index(value)]++;
+    histogram->total++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+void histogram_merge(struct histogram *total, const struct histogram *histogram) {
+    int i;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        total->counts[i] += histogram->counts[i];
+    }
+    total->total += histogram->total;
+    if (histogram->max > total->max) {
+        total->max = histogram->max;
+    }
+}
+
+uint64_t histogram_percentile(const struct histogram *histogram, double fraction) {
+    uint64_t target;
+    uint64_t seen;
+    uint64_t value;
+    int i;
+
+    target = (uint64_t)ceil(fraction * (double)histogram->total);
+    if (target == 0) {
+        target = 1;
+    }
+    seen = 0;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= target) {
+            value = histogram_bucket_high(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
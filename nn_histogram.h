@@ -0,0 +1,24 @@
+#ifndef NN_HISTOGRAM_H
+#define NN_HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Internal log-linear histogram in the style of HdrHistogram, shared by the
+   coalescer and the bench tool: values below 64 are exact, above that each
+   power of two is split into 32 buckets, so a reported percentile is within
+   about 3% of the true value. */
+#define HISTOGRAM_SUB_BUCKETS 32
+#define HISTOGRAM_EXACT_LIMIT (2 * HISTOGRAM_SUB_BUCKETS)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_EXACT_LIMIT + 58 * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+void histogram_record(struct histogram *histogram, uint64_t value);
+void histogram_merge(struct histogram *total, const struct histogram *histogram);
+uint64_t histogram_percentile(const struct histogram *histogram, double fraction);
+
+#endif
@@ -0,0 +1,607 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nn_func.h"
+#include "nn_metrics.h"
+#include "nn_trace.h"
+
+#define DENSE_TILE_ROWS 4
+#define DENSE_TILE_OUTPUTS 4
+#define DENSE_BLOCK_INPUTS 128
+#define DENSE_BLOCK_OUTPUTS 128
+#define DENSE_DELTA_CHUNK 512
+
+typedef void (*dense_array_kernel)(const double *input_array, double *output_array, size_t array_length);
+typedef void (*dense_strided_kernel)(const double *input_array, ptrdiff_t input_stride, double *output_array,
+                                     ptrdiff_t output_stride, size_t array_length);
+
+/* The epilogue runs once per finished row of a tile, so it uses the strided
+   kernels, which carry no trace or metrics hooks; dense_forward records the
+   whole call once. */
+static dense_strided_kernel dense_activation_kernel(activation_function activation) {
+    if (activation == relu) {
+        return relu_array_strided;
+    }
+    if (activation == sigmoid) {
+        return sigmoid_array_strided;
+    }
+    if (activation == tanh_activation) {
+        return tanh_array_strided;
+    }
+    if (activation == leaky_relu) {
+        return leaky_relu_array_strided;
+    }
+    if (activation == hard_sigmoid) {
+        return hard_sigmoid_array_strided;
+    }
+    if (activation == swish) {
+        return swish_array_strided;
+    }
+    return NULL;
+}
+
+static dense_array_kernel dense_derivative_kernel(activation_function activation_derivative) {
+    if (activation_derivative == relu_derivative) {
+        return relu_derivative_array;
+    }
+    if (activation_derivative == sigmoid_derivative) {
+        return sigmoid_derivative_array;
+    }
+    if (activation_derivative == tanh_derivative) {
+        return tanh_derivative_array;
+    }
+    if (activation_derivative == hard_sigmoid_derivative) {
+        return hard_sigmoid_derivative_array;
+    }
+    if (activation_derivative == swish_derivative) {
+        return swish_derivative_array;
+    }
+    return NULL;
+}
+
+/* delta = output_grad * derivative(pre_activation) over length elements.
+   With a separate delta the derivative kernel writes it in one call; when
+   delta aliases output_grad the derivative goes through a stack buffer of
+   DENSE_DELTA_CHUNK elements. */
+static void dense_delta(const double *pre_activation, const double *output_grad, double *delta, size_t length,
+                        activation_function activation_derivative, dense_array_kernel derivative_kernel) {
+    double derivative[DENSE_DELTA_CHUNK];
+    size_t start;
+    size_t count;
+    size_t i;
+
+    if (activation_derivative == NULL || activation_derivative == linear_derivative) {
+        if (delta != output_grad) {
+            memcpy(delta, output_grad, length * sizeof(*delta));
+        }
+        return;
+    }
+    if (derivative_kernel == NULL) {
+        for (i = 0; i < length; i++) {
+            delta[i] = output_grad[i] * activation_derivative(pre_activation[i]);
+        }
+        return;
+    }
+    if (delta != output_grad) {
+        derivative_kernel(pre_activation, delta, length);
+        for (i = 0; i < length; i++) {
+            delta[i] = output_grad[i] * delta[i];
+        }
+        return;
+    }
+    for (start = 0; start < length; start += count) {
+        count = length - start < DENSE_DELTA_CHUNK ? length - start : DENSE_DELTA_CHUNK;
+        derivative_kernel(pre_activation + start, derivative, count);
+        for (i = 0; i < count; i++) {
+            delta[start + i] = output_grad[start + i] * derivative[i];
+        }
+    }
+}
+
+/* Applies the activation to row_count finished rows of output_count outputs. */
+static void dense_epilogue(double *pre_activation, double *output, size_t row_count, size_t output_size,
+                           size_t output_count, activation_function activation,
+                           dense_strided_kernel activation_kernel) {
+    double *row_output;
+    size_t row;
+    size_t j;
+
+    for (row = 0; row < row_count; row++) {
+        row_output = output + row * output_size;
+        if (pre_activation != NULL) {
+            memcpy(pre_activation + row * output_size, row_output, output_count * sizeof(*row_output));
+        }
+        if (activation_kernel != NULL) {
+            activation_kernel(row_output, 1, row_output, 1, output_count);
+        } else if (activation != NULL && activation != linear) {
+            for (j = 0; j < output_count; j++) {
+                row_output[j] = activation(row_output[j]);
+            }
+        }
+    }
+}
+
+/* Two doubles, one SSE2 register. Plain scalar code lets gcc vectorize the
+   k loop with shuffles instead of broadcasting the input, which runs about a
+   third slower. */
+typedef double dense_vector __attribute__((vector_size(2 * sizeof(double))));
+
+#define DENSE_TILE_VECTORS (DENSE_TILE_OUTPUTS / 2)
+
+/* Adds k_count inputs times the matching weight rows to a DENSE_TILE_ROWS x
+   DENSE_TILE_OUTPUTS block of output. The accumulators take eight of the
+   sixteen xmm registers, leaving room for the weights and the broadcast
+   input. */
+static void dense_tile(const double *weights, const double *input, double *output, size_t input_size,
+                       size_t output_size, size_t k_count) {
+    dense_vector accumulator[DENSE_TILE_ROWS][DENSE_TILE_VECTORS];
+    dense_vector weight_row[DENSE_TILE_VECTORS];
+    dense_vector input_value;
+    double input_scalar;
+    size_t row;
+    size_t k;
+    size_t j;
+
+    for (row = 0; row < DENSE_TILE_ROWS; row++) {
+        memcpy(accumulator[row], output + row * output_size, sizeof(accumulator[row]));
+    }
+
+    for (k = 0; k < k_count; k++) {
+        memcpy(weight_row, weights + k * output_size, sizeof(weight_row));
+        for (row = 0; row < DENSE_TILE_ROWS; row++) {
+            input_scalar = input[row * input_size + k];
+            input_value = (dense_vector){input_scalar, input_scalar};
+            for (j = 0; j < DENSE_TILE_VECTORS; j++) {
+                accumulator[row][j] = accumulator[row][j] + input_value * weight_row[j];
+            }
+        }
+    }
+
+    for (row = 0; row < DENSE_TILE_ROWS; row++) {
+        memcpy(output + row * output_size, accumulator[row], sizeof(accumulator[row]));
+    }
+}
+
+static void dense_edge(const double *weights, const double *input, double *output, size_t row_count,
+                       size_t input_size, size_t output_size, size_t k_count, size_t output_count) {
+    double *row_output;
+    const double *weight_row;
+    double input_value;
+    size_t row;
+    size_t k;
+    size_t j;
+
+    for (row = 0; row < row_count; row++) {
+        row_output = output + row * output_size;
+        for (k = 0; k < k_count; k++) {
+            weight_row = weights + k * output_size;
+            input_value = input[row * input_size + k];
+            for (j = 0; j < output_count; j++) {
+                row_output[j] = row_output[j] + input_value * weight_row[j];
+            }
+        }
+    }
+}
+
+/* The weights are walked in DENSE_BLOCK_INPUTS x DENSE_BLOCK_OUTPUTS panels
+   (128 KB), which stay in L2 while every row tile of the batch passes over
+   them. The partial sums live in output between panels; once the last input
+   panel of a row tile is done, its rows are activated with the array kernel
+   while they are still in L1. */
+void dense_forward(const double *weights, const double *bias, const double *input,
+                   double *pre_activation, double *output, size_t batch_size,
+                   size_t input_size, size_t output_size, activation_function activation) {
+    dense_strided_kernel activation_kernel;
+    const double *block_weights;
+    const double *block_input;
+    double *tile_output;
+    size_t block_output_start;
+    size_t block_output_count;
+    size_t block_input_start;
+    size_t block_input_count;
+    size_t row_start;
+    size_t row_count;
+    size_t output_start;
+    size_t row;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    activation_kernel = dense_activation_kernel(activation);
+    for (block_output_start = 0; block_output_start < output_size; block_output_start += DENSE_BLOCK_OUTPUTS) {
+        block_output_count = output_size - block_output_start;
+        if (block_output_count > DENSE_BLOCK_OUTPUTS) {
+            block_output_count = DENSE_BLOCK_OUTPUTS;
+        }
+        for (row = 0; row < batch_size; row++) {
+            tile_output = output + row * output_size + block_output_start;
+            if (bias != NULL) {
+                memcpy(tile_output, bias + block_output_start, block_output_count * sizeof(*bias));
+            } else {
+                memset(tile_output, 0, block_output_count * sizeof(*tile_output));
+            }
+        }
+        for (block_input_start = 0; block_input_start < input_size; block_input_start += DENSE_BLOCK_INPUTS) {
+            block_input_count = input_size - block_input_start;
+            if (block_input_count > DENSE_BLOCK_INPUTS) {
+                block_input_count = DENSE_BLOCK_INPUTS;
+            }
+            block_weights = weights + block_input_start * output_size + block_output_start;
+            for (row_start = 0; row_start < batch_size; row_start += DENSE_TILE_ROWS) {
+                row_count = batch_size - row_start;
+                if (row_count > DENSE_TILE_ROWS) {
+                    row_count = DENSE_TILE_ROWS;
+                }
+                block_input = input + row_start * input_size + block_input_start;
+                tile_output = output + row_start * output_size + block_output_start;
+                if (row_count < DENSE_TILE_ROWS) {
+                    dense_edge(block_weights, block_input, tile_output, row_count, input_size, output_size,
+                               block_input_count, block_output_count);
+                } else {
+                    for (output_start = 0; output_start + DENSE_TILE_OUTPUTS <= block_output_count;
+                         output_start += DENSE_TILE_OUTPUTS) {
+                        dense_tile(block_weights + output_start, block_input, tile_output + output_start,
+                                   input_size, output_size, block_input_count);
+                    }
+                    if (output_start < block_output_count) {
+                        dense_edge(block_weights + output_start, block_input, tile_output + output_start,
+                                   row_count, input_size, output_size, block_input_count,
+                                   block_output_count - output_start);
+                    }
+                }
+                if (block_input_start + block_input_count == input_size) {
+                    dense_epilogue(pre_activation != NULL ? pre_activation + row_start * output_size + block_output_start
+                                                          : NULL,
+                                   output + row_start * output_size + block_output_start, row_count, output_size,
+                                   block_output_count, activation, activation_kernel);
+                }
+            }
+        }
+        if (input_size == 0) {
+            dense_epilogue(pre_activation != NULL ? pre_activation + block_output_start : NULL,
+                           output + block_output_start, batch_size, output_size, block_output_count, activation,
+                           activation_kernel);
+        }
+    }
+    metrics_end(METRICS_DENSE_FORWARD, metrics_start, output, batch_size * output_size);
+    TRACE_END();
+}
+
+size_t mlp_scratch_length(const struct dense_layer *layers, size_t layer_count, size_t batch_size) {
+    size_t widest;
+    size_t i;
+
+    widest = 0;
+    for (i = 0; i < layer_count; i++) {
+        if (layers[i].output_size > widest) {
+            widest = layers[i].output_size;
+        }
+    }
+    return 2 * widest * batch_size;
+}
+
+void mlp_forward(const struct dense_layer *layers, size_t layer_count, const double *input,
+                 double *output, size_t batch_size, double *scratch) {
+    const double *layer_input;
+    double *layer_output;
+    double *buffers[2];
+    size_t i;
+    TRACE_BEGIN();
+
+    if (layer_count == 0) {
+        TRACE_END();
+        return;
+    }
+    buffers[0] = scratch;
+    buffers[1] = scratch + mlp_scratch_length(layers, layer_count, batch_size) / 2;
+
+    layer_input = input;
+    for (i = 0; i < layer_count; i++) {
+        if (i == layer_count - 1) {
+            layer_output = output;
+        } else {
+            layer_output = buffers[i % 2];
+        }
+        dense_forward(layers[i].weights, layers[i].bias, layer_input, NULL, layer_output,
+                      batch_size, layers[i].input_size, layers[i].output_size,
+                      layers[i].activation);
+        layer_input = layer_output;
+    }
+    TRACE_END();
+}
+
+/* The body of dense_backward without tracing or metrics, shared with the
+   shards of dense_backward_parallel, which resolve derivative_kernel once. */
+static void dense_backward_rows(const double *weights, const double *input, const double *pre_activation,
+                                const double *output_grad, double *delta, double *weight_grad, double *bias_grad,
+                                double *input_grad, size_t batch_size, size_t input_size, size_t output_size,
+                                activation_function activation_derivative, dense_array_kernel derivative_kernel) {
+    const double *delta_row;
+    const double *weight_row;
+    double *weight_grad_row;
+    double input_value;
+    double sum;
+    size_t row;
+    size_t k;
+    size_t j;
+
+    dense_delta(pre_activation, output_grad, delta, batch_size * output_size, activation_derivative,
+                derivative_kernel);
+
+    for (j = 0; j < output_size; j++) {
+        bias_grad[j] = 0.0;
+    }
+    for (k = 0; k < input_size * output_size; k++) {
+        weight_grad[k] = 0.0;
+    }
+    for (row = 0; row < batch_size; row++) {
+        delta_row = delta + row * output_size;
+        for (j = 0; j < output_size; j++) {
+            bias_grad[j] = bias_grad[j] + delta_row[j];
+        }
+        for (k = 0; k < input_size; k++) {
+            input_value = input[row * input_size + k];
+            weight_grad_row = weight_grad + k * output_size;
+            for (j = 0; j < output_size; j++) {
+                weight_grad_row[j] = weight_grad_row[j] + input_value * delta_row[j];
+            }
+        }
+    }
+
+    if (input_grad == NULL) {
+        return;
+    }
+    for (row = 0; row < batch_size; row++) {
+        delta_row = delta + row * output_size;
+        for (k = 0; k < input_size; k++) {
+            weight_row = weights + k * output_size;
+            sum = 0.0;
+            for (j = 0; j < output_size; j++) {
+                sum = sum + delta_row[j] * weight_row[j];
+            }
+            input_grad[row * input_size + k] = sum;
+        }
+    }
+}
+
+void dense_backward(const double *weights, const double *input, const double *pre_activation,
+                    const double *output_grad, double *delta, double *weight_grad, double *bias_grad,
+                    double *input_grad, size_t batch_size, size_t input_size, size_t output_size,
+                    activation_function activation_derivative) {
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    metrics_start = metrics_begin();
+    dense_backward_rows(weights, input, pre_activation, output_grad, delta, weight_grad, bias_grad, input_grad,
+                        batch_size, input_size, output_size, activation_derivative,
+                        dense_derivative_kernel(activation_derivative));
+    metrics_end(METRICS_DENSE_BACKWARD, metrics_start, delta, batch_size * output_size);
+    TRACE_END();
+}
+
+void sgd_update(double *params, const double *grads, size_t count, double learning_rate) {
+    size_t i;
+    for (i = 0; i < count; i++) {
+        params[i] = params[i] - learning_rate * grads[i];
+    }
+}
+
+void adam_update(double *params, const double *grads, double *first_moment, double *second_moment,
+                 size_t count, int step, double learning_rate, double beta1, double beta2,
+                 double epsilon) {
+    double first_correction;
+    double second_correction;
+    double step_size;
+    double grad;
+    size_t i;
+
+    if (step < 1) {
+        return;
+    }
+    first_correction = 1.0 - pow(beta1, step);
+    second_correction = 1.0 - pow(beta2, step);
+    step_size = learning_rate / first_correction;
+
+    for (i = 0; i < count; i++) {
+        grad = grads[i];
+        first_moment[i] = beta1 * first_moment[i] + (1.0 - beta1) * grad;
+        second_moment[i] = beta2 * second_moment[i] + (1.0 - beta2) * grad * grad;
+        params[i] = params[i] - step_size * first_moment[i] /
+                                (sqrt(second_moment[i] / second_correction) + epsilon);
+    }
+}
+
+struct backward_shard {
+    const double *weights;
+    const double *input;
+    const double *pre_activation;
+    const double *output_grad;
+    double *delta;
+    double *weight_grad;
+    double *bias_grad;
+    double *input_grad;
+    double *shared_weight_grad;
+    double *shared_bias_grad;
+    size_t batch_size;
+    size_t input_size;
+    size_t output_size;
+    activation_function activation_derivative;
+    dense_array_kernel derivative_kernel;
+};
+
+struct reduce_pair {
+    double *target_weight_grad;
+    double *target_bias_grad;
+    const double *source_weight_grad;
+    const double *source_bias_grad;
+    size_t weight_length;
+    size_t bias_length;
+};
+
+static void atomic_add_double(double *target, double value) {
+    double expected;
+    double desired;
+
+    __atomic_load(target, &expected, __ATOMIC_RELAXED);
+    do {
+        desired = expected + value;
+    } while (!__atomic_compare_exchange(target, &expected, &desired, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+}
+
+static void backward_shard_task(void *argument) {
+    struct backward_shard *shard = argument;
+    size_t i;
+
+    dense_backward_rows(shard->weights, shard->input, shard->pre_activation, shard->output_grad, shard->delta,
+                        shard->weight_grad, shard->bias_grad, shard->input_grad, shard->batch_size,
+                        shard->input_size, shard->output_size, shard->activation_derivative,
+                        shard->derivative_kernel);
+
+    if (shard->shared_weight_grad == NULL) {
+        return;
+    }
+    for (i = 0; i < shard->input_size * shard->output_size; i++) {
+        atomic_add_double(&shard->shared_weight_grad[i], shard->weight_grad[i]);
+    }
+    for (i = 0; i < shard->output_size; i++) {
+        atomic_add_double(&shard->shared_bias_grad[i], shard->bias_grad[i]);
+    }
+}
+
+static void reduce_pair_task(void *argument) {
+    struct reduce_pair *pair = argument;
+    size_t i;
+
+    for (i = 0; i < pair->weight_length; i++) {
+        pair->target_weight_grad[i] = pair->target_weight_grad[i] + pair->source_weight_grad[i];
+    }
+    for (i = 0; i < pair->bias_length; i++) {
+        pair->target_bias_grad[i] = pair->target_bias_grad[i] + pair->source_bias_grad[i];
+    }
+}
+
+void dense_backward_parallel(struct thread_pool *pool, enum gradient_reduction reduction,
+                             const double *weights, const double *input, const double *pre_activation,
+                             const double *output_grad, double *delta, double *weight_grad,
+                             double *bias_grad, double *input_grad, size_t batch_size,
+                             size_t input_size, size_t output_size,
+                             activation_function activation_derivative) {
+    struct backward_shard *shards;
+    struct reduce_pair *pairs;
+    dense_array_kernel derivative_kernel;
+    void **arguments;
+    double *private_grads;
+    size_t weight_length;
+    size_t shard_length;
+    size_t shard_count;
+    size_t private_count;
+    size_t row_start;
+    size_t rows;
+    size_t stride;
+    size_t pair_count;
+    size_t i;
+    uint64_t metrics_start;
+    TRACE_BEGIN();
+
+    shard_count = (size_t)thread_pool_size(pool);
+    if (shard_count > batch_size) {
+        shard_count = batch_size;
+    }
+    if (shard_count <= 1) {
+        dense_backward(weights, input, pre_activation, output_grad, delta, weight_grad, bias_grad,
+                       input_grad, batch_size, input_size, output_size, activation_derivative);
+        TRACE_END();
+        return;
+    }
+
+    weight_length = input_size * output_size;
+    shard_length = weight_length + output_size;
+    private_count = reduction == GRADIENT_REDUCTION_ATOMIC ? shard_count : shard_count - 1;
+    shards = malloc(shard_count * sizeof(*shards));
+    pairs = malloc(shard_count * sizeof(*pairs));
+    arguments = malloc(shard_count * sizeof(*arguments));
+    private_grads = malloc(private_count * shard_length * sizeof(double));
+    if (shards == NULL || pairs == NULL || arguments == NULL || private_grads == NULL) {
+        free(shards);
+        free(pairs);
+        free(arguments);
+        free(private_grads);
+        dense_backward(weights, input, pre_activation, output_grad, delta, weight_grad, bias_grad,
+                       input_grad, batch_size, input_size, output_size, activation_derivative);
+        TRACE_END();
+        return;
+    }
+
+    metrics_start = metrics_begin();
+    derivative_kernel = dense_derivative_kernel(activation_derivative);
+    row_start = 0;
+    for (i = 0; i < shard_count; i++) {
+        rows = batch_size / shard_count + (i < batch_size % shard_count ? 1 : 0);
+        shards[i].weights = weights;
+        shards[i].input = input + row_start * input_size;
+        shards[i].pre_activation = pre_activation + row_start * output_size;
+        shards[i].output_grad = output_grad + row_start * output_size;
+        shards[i].delta = delta + row_start * output_size;
+        shards[i].input_grad = input_grad != NULL ? input_grad + row_start * input_size : NULL;
+        shards[i].batch_size = rows;
+        shards[i].input_size = input_size;
+        shards[i].output_size = output_size;
+        shards[i].activation_derivative = activation_derivative;
+        shards[i].derivative_kernel = derivative_kernel;
+        if (reduction == GRADIENT_REDUCTION_ATOMIC) {
+            shards[i].weight_grad = private_grads + i * shard_length;
+            shards[i].bias_grad = shards[i].weight_grad + weight_length;
+            shards[i].shared_weight_grad = weight_grad;
+            shards[i].shared_bias_grad = bias_grad;
+        } else if (i == 0) {
+            shards[i].weight_grad = weight_grad;
+            shards[i].bias_grad = bias_grad;
+            shards[i].shared_weight_grad = NULL;
+            shards[i].shared_bias_grad = NULL;
+        } else {
+            shards[i].weight_grad = private_grads + (i - 1) * shard_length;
+            shards[i].bias_grad = shards[i].weight_grad + weight_length;
+            shards[i].shared_weight_grad = NULL;
+            shards[i].shared_bias_grad = NULL;
+        }
+        arguments[i] = &shards[i];
+        row_start += rows;
+    }
+
+    if (reduction == GRADIENT_REDUCTION_ATOMIC) {
+        for (i = 0; i < weight_length; i++) {
+            weight_grad[i] = 0.0;
+        }
+        for (i = 0; i < output_size; i++) {
+            bias_grad[i] = 0.0;
+        }
+    }
+    thread_pool_run(pool, backward_shard_task, arguments, (int)shard_count);
+
+    if (reduction == GRADIENT_REDUCTION_TREE) {
+        for (stride = 1; stride < shard_count; stride *= 2) {
+            pair_count = 0;
+            for (i = 0; i + stride < shard_count; i += 2 * stride) {
+                pairs[pair_count].target_weight_grad = shards[i].weight_grad;
+                pairs[pair_count].target_bias_grad = shards[i].bias_grad;
+                pairs[pair_count].source_weight_grad = shards[i + stride].weight_grad;
+                pairs[pair_count].source_bias_grad = shards[i + stride].bias_grad;
+                pairs[pair_count].weight_length = weight_length;
+                pairs[pair_count].bias_length = output_size;
+                arguments[pair_count] = &pairs[pair_count];
+                pair_count++;
+            }
+            thread_pool_run(pool, reduce_pair_task, arguments, (int)pair_count);
+        }
+    }
+
+    free(shards);
+    free(pairs);
+    free(arguments);
+    free(private_grads);
+    metrics_end(METRICS_DENSE_BACKWARD, metrics_start, delta, batch_size * output_size);
+    TRACE_END();
+}
@@ -0,0 +1,454 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "nn_func.h"
+#include "nn_linalg.h"
+
+#define RATIONAL_FIT_SAMPLES 1024
+
+struct rational_shard {
+    const struct rational_activation *activation;
+    const double *input;
+    const double *output_grad;
+    double *input_grad;
+    double *numerator_grad;
+    double *denominator_grad;
+    size_t array_length;
+};
+
+static double rational_value(const struct rational_activation *activation, double input_value,
+                             double *numerator_out, double *series_out, double *denominator_out) {
+    double numerator;
+    double series;
+    double denominator;
+    int k;
+
+    numerator = activation->numerator[activation->numerator_degree];
+    for (k = activation->numerator_degree - 1; k >= 0; k--) {
+        numerator = numerator * input_value + activation->numerator[k];
+    }
+    series = 0.0;
+    for (k = activation->denominator_degree - 1; k >= 0; k--) {
+        series = (series + activation->denominator[k]) * input_value;
+    }
+    denominator = 1.0 + fabs(series);
+
+    if (numerator_out != NULL) {
+        *numerator_out = numerator;
+        *series_out = series;
+        *denominator_out = denominator;
+    }
+    return numerator / denominator;
+}
+
+void rational_forward(const struct rational_activation *activation, const double *input_array,
+                      double *output_array, size_t array_length) {
+    size_t i;
+    for (i = 0; i < array_length; i++) {
+        output_array[i] = rational_value(activation, input_array[i], NULL, NULL, NULL);
+    }
+}
+
+void rational_backward(const struct rational_activation *activation, const double *input_array,
+                       const double *output_grad, double *input_grad, double *numerator_grad,
+                       double *denominator_grad, size_t array_length) {
+    double input_value;
+    double numerator;
+    double series;
+    double denominator;
+    double numerator_slope;
+    double series_slope;
+    double series_sign;
+    double upstream;
+    double numerator_scale;
+    double denominator_scale;
+    double power;
+    size_t i;
+    int k;
+
+    for (k = 0; k <= activation->numerator_degree; k++) {
+        numerator_grad[k] = 0.0;
+    }
+    for (k = 0; k < activation->denominator_degree; k++) {
+        denominator_grad[k] = 0.0;
+    }
+
+    for (i = 0; i < array_length; i++) {
+        input_value = input_array[i];
+        rational_value(activation, input_value, &numerator, &series, &denominator);
+
+        numerator_slope = 0.0;
+        for (k = activation->numerator_degree; k >= 1; k--) {
+            numerator_slope = numerator_slope * input_value + k * activation->numerator[k];
+        }
+        series_slope = 0.0;
+        for (k = activation->denominator_degree; k >= 1; k--) {
+            series_slope = series_slope * input_value + k * activation->denominator[k - 1];
+        }
+        series_sign = series > 0.0 ? 1.0 : (series < 0.0 ? -1.0 : 0.0);
+
+        upstream = output_grad[i];
+        numerator_scale = upstream / denominator;
+        denominator_scale = -upstream * numerator / (denominator * denominator) * series_sign;
+        if (input_grad != NULL) {
+            input_grad[i] = numerator_scale * numerator_slope + denominator_scale * series_slope;
+        }
+
+        power = 1.0;
+        for (k = 0; k <= activation->numerator_degree; k++) {
+            numerator_grad[k] = numerator_grad[k] + numerator_scale * power;
+            power = power * input_value;
+        }
+        power = input_value;
+        for (k = 0; k < activation->denominator_degree; k++) {
+            denominator_grad[k] = denominator_grad[k] + denominator_scale * power;
+            power = power * input_value;
+        }
+    }
+}
+
+static void rational_shard_task(void *argument) {
+    struct rational_shard *shard = argument;
+    rational_backward(shard->activation, shard->input, shard->output_grad, shard->input_grad,
+                      shard->numerator_grad, shard->denominator_grad, shard->array_length);
+}
+
+void rational_backward_parallel(struct thread_pool *pool, const struct rational_activation *activation,
+                                const double *input_array, const double *output_grad, double *input_grad,
+                                double *numerator_grad, double *denominator_grad, size_t array_length) {
+    struct rational_shard *shards;
+    void **arguments;
+    double *private_grads;
+    size_t coefficient_count;
+    size_t shard_count;
+    size_t start;
+    size_t i;
+    int k;
+
+    shard_count = (size_t)thread_pool_size(pool);
+    if (shard_count > array_length) {
+        shard_count = array_length;
+    }
+    coefficient_count = (size_t)(activation->numerator_degree + 1 + activation->denominator_degree);
+    shards = malloc(shard_count * sizeof(*shards));
+    arguments = malloc(shard_count * sizeof(*arguments));
+    private_grads = malloc(shard_count * coefficient_count * sizeof(double));
+    if (shard_count <= 1 || shards == NULL || arguments == NULL || private_grads == NULL) {
+        free(shards);
+        free(arguments);
+        free(private_grads);
+        rational_backward(activation, input_array, output_grad, input_grad, numerator_grad,
+                          denominator_grad, array_length);
+        return;
+    }
+
+    start = 0;
+    for (i = 0; i < shard_count; i++) {
+        shards[i].activation = activation;
+        shards[i].input = input_array + start;
+        shards[i].output_grad = output_grad + start;
+        shards[i].input_grad = input_grad != NULL ? input_grad + start : NULL;
+        shards[i].numerator_grad = private_grads + i * coefficient_count;
+        shards[i].denominator_grad = shards[i].numerator_grad + activation->numerator_degree + 1;
+        shards[i].array_length = array_length / shard_count + (i < array_length % shard_count ? 1 : 0);
+        arguments[i] = &shards[i];
+        start += shards[i].array_length;
+    }
+    thread_pool_run(pool, rational_shard_task, arguments, (int)shard_count);
+
+    for (k = 0; k <= activation->numerator_degree; k++) {
+        numerator_grad[k] = 0.0;
+        for (i = 0; i < shard_count; i++) {
+            numerator_grad[k] = numerator_grad[k] + shards[i].numerator_grad[k];
+        }
+    }
+    for (k = 0; k < activation->denominator_degree; k++) {
+        denominator_grad[k] = 0.0;
+        for (i = 0; i < shard_count; i++) {
+            denominator_grad[k] = denominator_grad[k] + shards[i].denominator_grad[k];
+        }
+    }
+
+    free(shards);
+    free(arguments);
+    free(private_grads);
+}
+
+double rational_fit(struct rational_activation *activation, activation_function target,
+                    double low, double high) {
+    double *normal_matrix;
+    double *normal_rhs;
+    double *basis;
+    double input_value;
+    double target_value;
+    double power;
+    double error;
+    double max_error;
+    int unknowns;
+    int sample;
+    int row;
+    int column;
+    int k;
+
+    unknowns = activation->numerator_degree + 1 + activation->denominator_degree;
+    normal_matrix = calloc((size_t)(unknowns * unknowns), sizeof(double));
+    normal_rhs = calloc((size_t)unknowns, sizeof(double));
+    basis = malloc((size_t)unknowns * sizeof(double));
+    if (normal_matrix == NULL || normal_rhs == NULL || basis == NULL) {
+        free(normal_matrix);
+        free(normal_rhs);
+        free(basis);
+        return -1.0;
+    }
+
+    /* Linearised least squares: P(x) - f(x) * S(x) = f(x), with Q = 1 + S. */
+    for (sample = 0; sample < RATIONAL_FIT_SAMPLES; sample++) {
+        input_value = low + (high - low) * sample / (RATIONAL_FIT_SAMPLES - 1);
+        target_value = target(input_value);
+        power = 1.0;
+        for (k = 0; k <= activation->numerator_degree; k++) {
+            basis[k] = power;
+            power = power * input_value;
+        }
+        power = input_value;
+        for (k = 0; k < activation->denominator_degree; k++) {
+            basis[activation->numerator_degree + 1 + k] = -target_value * power;
+            power = power * input_value;
+        }
+        for (row = 0; row < unknowns; row++) {
+            for (column = 0; column < unknowns; column++) {
+                normal_matrix[row * unknowns + column] += basis[row] * basis[column];
+            }
+            normal_rhs[row] += basis[row] * target_value;
+        }
+    }
+
+    if (solve_linear_system(normal_matrix, normal_rhs, unknowns) != 0) {
+        free(normal_matrix);
+        free(normal_rhs);
+        free(basis);
+        return -1.0;
+    }
+    for (k = 0; k <= activation->numerator_degree; k++) {
+        activation->numerator[k] = normal_rhs[k];
+    }
+    for (k = 0; k < activation->denominator_degree; k++) {
+        activation->denominator[k] = normal_rhs[activation->numerator_degree + 1 + k];
+    }
+
+    max_error = 0.0;
+    for (sample = 0; sample < RATIONAL_FIT_SAMPLES; sample++) {
+        input_value = low + (high - low) * sample / (RATIONAL_FIT_SAMPLES - 1);
+        error = fabs(rational_value(activation, input_value, NULL, NULL, NULL) - target(input_value));
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+
+    free(normal_matrix);
+    free(normal_rhs);
+    free(basis);
+    return max_error;
+}
+
+struct spline_shard {
+    const struct spline_activation *activation;
+    const double *input;
+    const double *output_grad;
+    double *input_grad;
+    double *value_grad;
+    size_t array_length;
+};
+
+static size_t spline_segment_count(const struct spline_activation *activation) {
+    if (activation->kind == SPLINE_CUBIC) {
+        return activation->value_count - 3;
+    }
+    return activation->value_count - 1;
+}
+
+static size_t spline_locate(const struct spline_activation *activation, double input_value,
+                            double inverse_spacing, size_t segments, double *fraction, int *inside) {
+    double position;
+    size_t segment;
+
+    position = (input_value - activation->low) * inverse_spacing;
+    *inside = position >= 0.0 && position <= (double)segments;
+    if (position < 0.0) {
+        position = 0.0;
+    }
+    if (position > (double)segments) {
+        position = (double)segments;
+    }
+    segment = (size_t)position;
+    if (segment == segments) {
+        segment = segments - 1;
+    }
+    *fraction = position - (double)segment;
+    return segment;
+}
+
+void spline_forward(const struct spline_activation *activation, const double *input_array,
+                    double *output_array, size_t array_length) {
+    const double *values = activation->values;
+    double inverse_spacing;
+    double u;
+    double v;
+    size_t segments;
+    size_t segment;
+    size_t i;
+    int inside;
+
+    segments = spline_segment_count(activation);
+    inverse_spacing = (double)segments / (activation->high - activation->low);
+    if (activation->kind == SPLINE_LINEAR) {
+        for (i = 0; i < array_length; i++) {
+            if (isnan(input_array[i])) {
+                output_array[i] = NAN;
+                continue;
+            }
+            segment = spline_locate(activation, input_array[i], inverse_spacing, segments, &u, &inside);
+            output_array[i] = values[segment] + u * (values[segment + 1] - values[segment]);
+        }
+        return;
+    }
+    for (i = 0; i < array_length; i++) {
+        if (isnan(input_array[i])) {
+            output_array[i] = NAN;
+            continue;
+        }
+        segment = spline_locate(activation, input_array[i], inverse_spacing, segments, &u, &inside);
+        v = 1.0 - u;
+        output_array[i] = (values[segment] * v * v * v +
+                           values[segment + 1] * (3.0 * u * u * u - 6.0 * u * u + 4.0) +
+                           values[segment + 2] * (-3.0 * u * u * u + 3.0 * u * u + 3.0 * u + 1.0) +
+                           values[segment + 3] * u * u * u) / 6.0;
+    }
+}
+
+void spline_backward(const struct spline_activation *activation, const double *input_array,
+                     const double *output_grad, double *input_grad, double *value_grad,
+                     size_t array_length) {
+    const double *values = activation->values;
+    double inverse_spacing;
+    double upstream;
+    double slope;
+    double u;
+    double v;
+    size_t segments;
+    size_t segment;
+    size_t i;
+    int inside;
+
+    for (i = 0; i < activation->value_count; i++) {
+        value_grad[i] = 0.0;
+    }
+    segments = spline_segment_count(activation);
+    inverse_spacing = (double)segments / (activation->high - activation->low);
+
+    for (i = 0; i < array_length; i++) {
+        if (isnan(input_array[i])) {
+            if (input_grad != NULL) {
+                input_grad[i] = 0.0;
+            }
+            continue;
+        }
+        segment = spline_locate(activation, input_array[i], inverse_spacing, segments, &u, &inside);
+        upstream = output_grad[i];
+        v = 1.0 - u;
+        if (activation->kind == SPLINE_LINEAR) {
+            value_grad[segment] = value_grad[segment] + upstream * v;
+            value_grad[segment + 1] = value_grad[segment + 1] + upstream * u;
+            slope = values[segment + 1] - values[segment];
+        } else {
+            value_grad[segment] = value_grad[segment] + upstream * v * v * v / 6.0;
+            value_grad[segment + 1] = value_grad[segment + 1] +
+                                      upstream * (3.0 * u * u * u - 6.0 * u * u + 4.0) / 6.0;
+            value_grad[segment + 2] = value_grad[segment + 2] +
+                                      upstream * (-3.0 * u * u * u + 3.0 * u * u + 3.0 * u + 1.0) / 6.0;
+            value_grad[segment + 3] = value_grad[segment + 3] + upstream * u * u * u / 6.0;
+            slope = (-values[segment] * v * v + values[segment + 1] * (3.0 * u * u - 4.0 * u) +
+                     values[segment + 2] * (-3.0 * u * u + 2.0 * u + 1.0) +
+                     values[segment + 3] * u * u) / 2.0;
+        }
+        if (input_grad != NULL) {
+            input_grad[i] = inside ? upstream * slope * inverse_spacing : 0.0;
+        }
+    }
+}
+
+static void spline_shard_task(void *argument) {
+    struct spline_shard *shard = argument;
+    spline_backward(shard->activation, shard->input, shard->output_grad, shard->input_grad,
+                    shard->value_grad, shard->array_length);
+}
+
+void spline_backward_parallel(struct thread_pool *pool, const struct spline_activation *activation,
+                              const double *input_array, const double *output_grad, double *input_grad,
+                              double *value_grad, size_t array_length) {
+    struct spline_shard *shards;
+    void **arguments;
+    double *histograms;
+    size_t shard_count;
+    size_t start;
+    size_t i;
+    size_t k;
+
+    shard_count = (size_t)thread_pool_size(pool);
+    if (shard_count > array_length) {
+        shard_count = array_length;
+    }
+    shards = malloc(shard_count * sizeof(*shards));
+    arguments = malloc(shard_count * sizeof(*arguments));
+    histograms = malloc(shard_count * activation->value_count * sizeof(double));
+    if (shard_count <= 1 || shards == NULL || arguments == NULL || histograms == NULL) {
+        free(shards);
+        free(arguments);
+        free(histograms);
+        spline_backward(activation, input_array, output_grad, input_grad, value_grad, array_length);
+        return;
+    }
+
+    start = 0;
+    for (i = 0; i < shard_count; i++) {
+        shards[i].activation = activation;
+        shards[i].input = input_array + start;
+        shards[i].output_grad = output_grad + start;
+        shards[i].input_grad = input_grad != NULL ? input_grad + start : NULL;
+        shards[i].value_grad = histograms + i * activation->value_count;
+        shards[i].array_length = array_length / shard_count + (i < array_length % shard_count ? 1 : 0);
+        arguments[i] = &shards[i];
+        start += shards[i].array_length;
+    }
+    thread_pool_run(pool, spline_shard_task, arguments, (int)shard_count);
+
+    for (k = 0; k < activation->value_count; k++) {
+        value_grad[k] = 0.0;
+        for (i = 0; i < shard_count; i++) {
+            value_grad[k] = value_grad[k] + shards[i].value_grad[k];
+        }
+    }
+
+    free(shards);
+    free(arguments);
+    free(histograms);
+}
+
+void spline_fit(struct spline_activation *activation, activation_function target) {
+    double spacing;
+    size_t i;
+
+    if (activation->kind == SPLINE_LINEAR) {
+        spacing = (activation->high - activation->low) / (double)(activation->value_count - 1);
+        for (i = 0; i < activation->value_count; i++) {
+            activation->values[i] = target(activation->low + spacing * (double)i);
+        }
+        return;
+    }
+    /* Cubic control points are centred one spacing left of their knot. */
+    spacing = (activation->high - activation->low) / (double)(activation->value_count - 3);
+    for (i = 0; i < activation->value_count; i++) {
+        activation->values[i] = target(activation->low + spacing * ((double)i - 1.0));
+    }
+}
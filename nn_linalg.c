@@ -0,0 +1,50 @@
+#include <math.h>
+
+#include "nn_linalg.h"
+
+int solve_linear_system(double *matrix, double *rhs, int size) {
+    double pivot_value;
+    double factor;
+    double swap;
+    int pivot;
+    int row;
+    int column;
+    int k;
+
+    for (k = 0; k < size; k++) {
+        pivot = k;
+        for (row = k + 1; row < size; row++) {
+            if (fabs(matrix[row * size + k]) > fabs(matrix[pivot * size + k])) {
+                pivot = row;
+            }
+        }
+        pivot_value = matrix[pivot * size + k];
+        if (fabs(pivot_value) < 1e-300) {
+            return -1;
+        }
+        if (pivot != k) {
+            for (column = 0; column < size; column++) {
+                swap = matrix[k * size + column];
+                matrix[k * size + column] = matrix[pivot * size + column];
+                matrix[pivot * size + column] = swap;
+            }
+            swap = rhs[k];
+            rhs[k] = rhs[pivot];
+            rhs[pivot] = swap;
+        }
+        for (row = k + 1; row < size; row++) {
+            factor = matrix[row * size + k] / pivot_value;
+            for (column = k; column < size; column++) {
+                matrix[row * size + column] = matrix[row * size + column] - factor * matrix[k * size + column];
+            }
+            rhs[row] = rhs[row] - factor * rhs[k];
+        }
+    }
+    for (k = size - 1; k >= 0; k--) {
+        for (column = k + 1; column < size; column++) {
+            rhs[k] = rhs[k] - matrix[k * size + column] * rhs[column];
+        }
+        rhs[k] = rhs[k] / matrix[k * size + k];
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef NN_LINALG_H
+#define NN_LINALG_H
+
+/* Internal dense solver shared by rational_fit and the gen_approx tool.
+   Solves matrix * x = rhs by Gaussian elimination with partial pivoting;
+   matrix is size x size, row-major, and is overwritten, and the solution
+   replaces rhs. Returns -1 if the matrix is numerically singular. */
+int solve_linear_system(double *matrix, double *rhs, int size);
+
+#endif
@@ -0,0 +1,353 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nn_func.h"
+#include "nn_metrics.h"
+
+/* Histogram bucket i counts calls shorter than 2^(METRICS_FIRST_BUCKET_BITS + i)
+   nanoseconds, from about 1 us to about 1 s; the last bucket is +Inf. */
+#define METRICS_FIRST_BUCKET_BITS 10
+#define METRICS_BUCKETS 22
+
+struct kernel_metrics {
+    uint64_t calls;
+    uint64_t elements;
+    uint64_t nanoseconds;
+    uint64_t nan_outputs;
+    uint64_t buckets[METRICS_BUCKETS];
+};
+
+/* Each thread updates only its own shard, with relaxed stores, so readers
+   summing the shards never see torn values. Shards are pushed onto
+   metrics_shards with a CAS and stay there, which keeps the exported
+   counters monotonic. When a thread exits, a pthread key destructor puts its
+   shard on free_shards and the next new thread carries on counting in it,
+   so there are never more shards than threads alive at once. */
+struct metrics_shard {
+    struct kernel_metrics kernels[METRICS_KERNEL_COUNT];
+    struct metrics_shard *next;
+    struct metrics_shard *free_next;
+};
+
+static const char *kernel_names[METRICS_KERNEL_COUNT] = {
+    "softmax",
+    "sigmoid_array",
+    "sigmoid_derivative_array",
+    "tanh_array",
+    "tanh_derivative_array",
+    "relu_array",
+    "relu_derivative_array",
+    "leaky_relu_array",
+    "leaky_relu_derivative_array",
+    "hard_sigmoid_array",
+    "hard_sigmoid_derivative_array",
+    "elu_array",
+    "elu_derivative_array",
+    "swish_array",
+    "swish_derivative_array",
+    "dense_forward",
+    "dense_backward",
+};
+
+int metrics_enabled;
+
+static struct metrics_shard *metrics_shards;
+static _Thread_local struct metrics_shard *thread_shard;
+static struct metrics_shard *free_shards;
+static pthread_mutex_t free_shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+static int64_t queued_tasks;
+static uint64_t dispatched_tasks;
+
+/* export_control_mutex serializes metrics_export_start and
+   metrics_export_stop and guards export_running; export_mutex is shared
+   with the export thread. */
+static pthread_mutex_t export_control_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t export_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t export_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t export_thread;
+static char *export_path;
+static double export_interval;
+static int export_running;
+static int export_stopping;
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec + 1;
+}
+
+static void metrics_shard_release(void *argument) {
+    struct metrics_shard *shard = argument;
+
+    pthread_mutex_lock(&free_shards_mutex);
+    shard->free_next = free_shards;
+    free_shards = shard;
+    pthread_mutex_unlock(&free_shards_mutex);
+}
+
+static void metrics_shard_key_create(void) {
+    pthread_key_create(&shard_key, metrics_shard_release);
+}
+
+static struct metrics_shard *metrics_thread_shard(void) {
+    struct metrics_shard *shard;
+
+    if (thread_shard != NULL) {
+        return thread_shard;
+    }
+    pthread_once(&shard_key_once, metrics_shard_key_create);
+    pthread_mutex_lock(&free_shards_mutex);
+    shard = free_shards;
+    if (shard != NULL) {
+        free_shards = shard->free_next;
+    }
+    pthread_mutex_unlock(&free_shards_mutex);
+    if (shard == NULL) {
+        shard = calloc(1, sizeof(*shard));
+        if (shard == NULL) {
+            return NULL;
+        }
+        shard->next = __atomic_load_n(&metrics_shards, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&metrics_shards, &shard->next, shard, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(shard_key, shard);
+    thread_shard = shard;
+    return shard;
+}
+
+static void counter_add(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+void metrics_end(enum metrics_kernel kernel, uint64_t start_nanoseconds, const double *output, size_t length) {
+    struct kernel_metrics *metrics;
+    struct metrics_shard *shard;
+    uint64_t elapsed;
+    uint64_t nan_outputs;
+    int bucket;
+    size_t i;
+
+    if (start_nanoseconds == 0) {
+        return;
+    }
+    elapsed = metrics_now() - start_nanoseconds;
+    nan_outputs = 0;
+    if (output != NULL) {
+        for (i = 0; i < length; i++) {
+            nan_outputs += output[i] != output[i];
+        }
+    }
+    shard = metrics_thread_shard();
+    if (shard == NULL) {
+        return;
+    }
+    bucket = 0;
+    while (bucket < METRICS_BUCKETS - 1 && elapsed >= (uint64_t)1 << (METRICS_FIRST_BUCKET_BITS + bucket)) {
+        bucket++;
+    }
+    metrics = &shard->kernels[kernel];
+    counter_add(&metrics->calls, 1);
+    counter_add(&metrics->elements, length);
+    counter_add(&metrics->nanoseconds, elapsed);
+    counter_add(&metrics->nan_outputs, nan_outputs);
+    counter_add(&metrics->buckets[bucket], 1);
+}
+
+void metrics_queue_push(int task_count) {
+    __atomic_add_fetch(&queued_tasks, task_count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&dispatched_tasks, (uint64_t)task_count, __ATOMIC_RELAXED);
+}
+
+void metrics_queue_pop(void) {
+    __atomic_sub_fetch(&queued_tasks, 1, __ATOMIC_RELAXED);
+}
+
+void metrics_enable(int enabled) {
+    __atomic_store_n(&metrics_enabled, enabled != 0, __ATOMIC_RELAXED);
+}
+
+static void metrics_sum(struct kernel_metrics *totals) {
+    struct metrics_shard *shard;
+    const struct kernel_metrics *metrics;
+    int kernel;
+    int bucket;
+
+    memset(totals, 0, METRICS_KERNEL_COUNT * sizeof(*totals));
+    for (shard = __atomic_load_n(&metrics_shards, __ATOMIC_ACQUIRE); shard != NULL; shard = shard->next) {
+        for (kernel = 0; kernel < METRICS_KERNEL_COUNT; kernel++) {
+            metrics = &shard->kernels[kernel];
+            totals[kernel].calls += __atomic_load_n(&metrics->calls, __ATOMIC_RELAXED);
+            totals[kernel].elements += __atomic_load_n(&metrics->elements, __ATOMIC_RELAXED);
+            totals[kernel].nanoseconds += __atomic_load_n(&metrics->nanoseconds, __ATOMIC_RELAXED);
+            totals[kernel].nan_outputs += __atomic_load_n(&metrics->nan_outputs, __ATOMIC_RELAXED);
+            for (bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+                totals[kernel].buckets[bucket] += __atomic_load_n(&metrics->buckets[bucket], __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+static void write_counter(FILE *file, const char *name, const char *help, const struct kernel_metrics *totals,
+                          size_t offset) {
+    int kernel;
+
+    fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (kernel = 0; kernel < METRICS_KERNEL_COUNT; kernel++) {
+        if (totals[kernel].calls == 0) {
+            continue;
+        }
+        fprintf(file, "%s{kernel=\"%s\"} %llu\n", name, kernel_names[kernel],
+                (unsigned long long)*(const uint64_t *)((const char *)&totals[kernel] + offset));
+    }
+}
+
+int metrics_write_prometheus(const char *path) {
+    struct kernel_metrics totals[METRICS_KERNEL_COUNT];
+    char *temporary_path;
+    FILE *file;
+    uint64_t cumulative;
+    int kernel;
+    int bucket;
+    int failed;
+
+    temporary_path = malloc(strlen(path) + 5);
+    if (temporary_path == NULL) {
+        return -1;
+    }
+    strcpy(temporary_path, path);
+    strcat(temporary_path, ".tmp");
+    file = fopen(temporary_path, "w");
+    if (file == NULL) {
+        free(temporary_path);
+        return -1;
+    }
+
+    metrics_sum(totals);
+    write_counter(file, "nn_func_calls_total", "Calls per kernel.", totals,
+                  offsetof(struct kernel_metrics, calls));
+    write_counter(file, "nn_func_elements_total", "Elements processed per kernel.", totals,
+                  offsetof(struct kernel_metrics, elements));
+    write_counter(file, "nn_func_nan_outputs_total", "NaN outputs produced per kernel.", totals,
+                  offsetof(struct kernel_metrics, nan_outputs));
+
+    fprintf(file, "# HELP nn_func_call_duration_seconds Wall time per kernel call.\n"
+                  "# TYPE nn_func_call_duration_seconds histogram\n");
+    for (kernel = 0; kernel < METRICS_KERNEL_COUNT; kernel++) {
+        if (totals[kernel].calls == 0) {
+            continue;
+        }
+        cumulative = 0;
+        for (bucket = 0; bucket < METRICS_BUCKETS - 1; bucket++) {
+            cumulative += totals[kernel].buckets[bucket];
+            fprintf(file, "nn_func_call_duration_seconds_bucket{kernel=\"%s\",le=\"%.9g\"} %llu\n",
+                    kernel_names[kernel], (double)((uint64_t)1 << (METRICS_FIRST_BUCKET_BITS + bucket)) * 1e-9,
+                    (unsigned long long)cumulative);
+        }
+        fprintf(file, "nn_func_call_duration_seconds_bucket{kernel=\"%s\",le=\"+Inf\"} %llu\n",
+                kernel_names[kernel], (unsigned long long)totals[kernel].calls);
+        fprintf(file, "nn_func_call_duration_seconds_sum{kernel=\"%s\"} %.9f\n", kernel_names[kernel],
+                (double)totals[kernel].nanoseconds * 1e-9);
+        fprintf(file, "nn_func_call_duration_seconds_count{kernel=\"%s\"} %llu\n", kernel_names[kernel],
+                (unsigned long long)totals[kernel].calls);
+    }
+
+    fprintf(file, "# HELP nn_func_thread_pool_queue_depth Pool tasks dispatched but not yet started.\n"
+                  "# TYPE nn_func_thread_pool_queue_depth gauge\n"
+                  "nn_func_thread_pool_queue_depth %lld\n",
+            (long long)__atomic_load_n(&queued_tasks, __ATOMIC_RELAXED));
+    fprintf(file, "# HELP nn_func_thread_pool_tasks_total Pool tasks dispatched.\n"
+                  "# TYPE nn_func_thread_pool_tasks_total counter\n"
+                  "nn_func_thread_pool_tasks_total %llu\n",
+            (unsigned long long)__atomic_load_n(&dispatched_tasks, __ATOMIC_RELAXED));
+
+    failed = ferror(file);
+    if (fclose(file) != 0) {
+        failed = 1;
+    }
+    if (!failed && rename(temporary_path, path) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        remove(temporary_path);
+    }
+    free(temporary_path);
+    return failed ? -1 : 0;
+}
+
+static void *metrics_export_worker(void *unused) {
+    struct timespec deadline;
+    double next;
+
+    (void)unused;
+    pthread_mutex_lock(&export_mutex);
+    while (!export_stopping) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        next = (double)deadline.tv_nsec * 1e-9 + export_interval;
+        deadline.tv_sec += (time_t)next;
+        deadline.tv_nsec = (long)((next - (double)(time_t)next) * 1e9);
+        while (!export_stopping && pthread_cond_timedwait(&export_wake, &export_mutex, &deadline) == 0) {
+        }
+        pthread_mutex_unlock(&export_mutex);
+        metrics_write_prometheus(export_path);
+        pthread_mutex_lock(&export_mutex);
+    }
+    pthread_mutex_unlock(&export_mutex);
+    return NULL;
+}
+
+/* Called with export_control_mutex held. */
+static void metrics_export_stop_locked(void) {
+    if (!export_running) {
+        return;
+    }
+    pthread_mutex_lock(&export_mutex);
+    export_stopping = 1;
+    pthread_cond_signal(&export_wake);
+    pthread_mutex_unlock(&export_mutex);
+    pthread_join(export_thread, NULL);
+    export_running = 0;
+    free(export_path);
+    export_path = NULL;
+}
+
+int metrics_export_start(const char *path, double interval_seconds) {
+    if (!(interval_seconds > 0.0)) {
+        return -1;
+    }
+    pthread_mutex_lock(&export_control_mutex);
+    metrics_export_stop_locked();
+    export_path = malloc(strlen(path) + 1);
+    if (export_path == NULL) {
+        pthread_mutex_unlock(&export_control_mutex);
+        return -1;
+    }
+    strcpy(export_path, path);
+    export_interval = interval_seconds;
+    export_stopping = 0;
+    if (pthread_create(&export_thread, NULL, metrics_export_worker, NULL) != 0) {
+        free(export_path);
+        export_path = NULL;
+        pthread_mutex_unlock(&export_control_mutex);
+        return -1;
+    }
+    export_running = 1;
+    pthread_mutex_unlock(&export_control_mutex);
+    metrics_enable(1);
+    return 0;
+}
+
+void metrics_export_stop(void) {
+    pthread_mutex_lock(&export_control_mutex);
+    metrics_export_stop_locked();
+    pthread_mutex_unlock(&export_control_mutex);
+}
@@ -0,0 +1,46 @@
+#ifndef NN_METRICS_H
+#define NN_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Internal hooks for the metrics registry. metrics_begin returns 0 when
+   collection is off, and metrics_end then returns at once, so a disabled
+   kernel pays one relaxed load and one call. */
+
+enum metrics_kernel {
+    METRICS_SOFTMAX,
+    METRICS_SIGMOID_ARRAY,
+    METRICS_SIGMOID_DERIVATIVE_ARRAY,
+    METRICS_TANH_ARRAY,
+    METRICS_TANH_DERIVATIVE_ARRAY,
+    METRICS_RELU_ARRAY,
+    METRICS_RELU_DERIVATIVE_ARRAY,
+    METRICS_LEAKY_RELU_ARRAY,
+    METRICS_LEAKY_RELU_DERIVATIVE_ARRAY,
+    METRICS_HARD_SIGMOID_ARRAY,
+    METRICS_HARD_SIGMOID_DERIVATIVE_ARRAY,
+    METRICS_ELU_ARRAY,
+    METRICS_ELU_DERIVATIVE_ARRAY,
+    METRICS_SWISH_ARRAY,
+    METRICS_SWISH_DERIVATIVE_ARRAY,
+    METRICS_DENSE_FORWARD,
+    METRICS_DENSE_BACKWARD,
+    METRICS_KERNEL_COUNT
+};
+
+extern int metrics_enabled;
+
+uint64_t metrics_now(void);
+void metrics_end(enum metrics_kernel kernel, uint64_t start_nanoseconds, const double *output, size_t length);
+void metrics_queue_push(int task_count);
+void metrics_queue_pop(void);
+
+static inline uint64_t metrics_begin(void) {
+    if (!__atomic_load_n(&metrics_enabled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return metrics_now();
+}
+
+#endif
@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "nn_func.h"
+#include "nn_metrics.h"
+#include "nn_trace.h"
+
+struct thread_pool {
+    pthread_mutex_t mutex;
+    pthread_mutex_t run_mutex;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    pthread_t *threads;
+    int thread_count;
+    thread_pool_task task;
+    void **arguments;
+    int task_count;
+    int next_task;
+    int pending_tasks;
+    int denormal_flush;
+    int shutdown;
+};
+
+static void thread_pool_execute(thread_pool_task task, void *argument) {
+    TRACE_BEGIN();
+
+    task(argument);
+    TRACE_END_NAMED("thread_pool_task");
+}
+
+static void *thread_pool_worker(void *pool_pointer) {
+    struct thread_pool *pool = pool_pointer;
+    thread_pool_task task;
+    void *argument;
+    int denormal_flush;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->shutdown && pool->next_task >= pool->task_count) {
+            pthread_cond_wait(&pool->work_ready, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        task = pool->task;
+        argument = pool->arguments[pool->next_task];
+        denormal_flush = pool->denormal_flush;
+        pool->next_task++;
+        metrics_queue_pop();
+        pthread_mutex_unlock(&pool->mutex);
+
+        /* Tasks run under the flush setting of the thread that called
+           thread_pool_run. */
+        denormal_flush_set(denormal_flush);
+        thread_pool_execute(task, argument);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->pending_tasks--;
+        if (pool->pending_tasks == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+struct thread_pool *thread_pool_create(int thread_count) {
+    struct thread_pool *pool;
+    int i;
+
+    if (thread_count < 1) {
+        return NULL;
+    }
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_mutex_init(&pool->run_mutex, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool) != 0) {
+            break;
+        }
+    }
+    pool->thread_count = i;
+    if (pool->thread_count == 0) {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool) {
+    int i;
+
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->mutex);
+    for (i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->run_mutex);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+}
+
+int thread_pool_size(const struct thread_pool *pool) {
+    if (pool == NULL) {
+        return 1;
+    }
+    return pool->thread_count;
+}
+
+void thread_pool_run(struct thread_pool *pool, thread_pool_task task, void **arguments, int task_count) {
+    int i;
+
+    if (task_count <= 0) {
+        return;
+    }
+    if (pool == NULL) {
+        for (i = 0; i < task_count; i++) {
+            thread_pool_execute(task, arguments[i]);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->run_mutex);
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->arguments = arguments;
+    pool->task_count = task_count;
+    pool->next_task = 0;
+    pool->pending_tasks = task_count;
+    pool->denormal_flush = denormal_flush_get();
+    metrics_queue_push(task_count);
+    pthread_cond_broadcast(&pool->work_ready);
+    while (pool->pending_tasks > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->mutex);
+    }
+    pool->task_count = 0;
+    pool->next_task = 0;
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&pool->run_mutex);
+}
@@ -0,0 +1,69 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "nn_func.h"
+
+/* Usage: nn_served SOCKET [THREADS [BUDGET_US [MAX_BATCH]]]. Serves until
+   SIGINT or SIGTERM, then prints the batching stats of each kernel used. */
+
+static const char *kernel_names[COALESCE_SOFTMAX + 1] = {
+    "sigmoid", "tanh", "relu", "leaky_relu", "hard_sigmoid", "swish", "softmax",
+};
+
+int main(int argc, char **argv) {
+    struct activation_service *service;
+    struct coalescer_stats stats;
+    struct thread_pool *pool;
+    sigset_t signals;
+    size_t max_batch_elements;
+    double budget_seconds;
+    long thread_count;
+    int signal_number;
+    int kernel;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SOCKET [THREADS [BUDGET_US [MAX_BATCH]]]\n", argv[0]);
+        return 2;
+    }
+    thread_count = argc > 2 ? atol(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    budget_seconds = argc > 3 ? atof(argv[3]) * 1e-6 : 50e-6;
+    max_batch_elements = argc > 4 ? (size_t)strtoul(argv[4], NULL, 10) : 16384;
+
+    /* Blocked before any thread starts, so only sigwait sees them. */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pool = thread_count > 1 ? thread_pool_create((int)thread_count) : NULL;
+    service = activation_service_start(argv[1], pool, max_batch_elements, budget_seconds);
+    if (service == NULL) {
+        fprintf(stderr, "%s: could not serve on %s\n", argv[0], argv[1]);
+        thread_pool_destroy(pool);
+        return 1;
+    }
+    printf("serving on %s: %d pool threads, budget %.0f us, batches of up to %zu elements\n", argv[1],
+           thread_pool_size(pool), budget_seconds * 1e6, max_batch_elements);
+    fflush(stdout);
+
+    sigwait(&signals, &signal_number);
+    for (kernel = 0; kernel <= COALESCE_SOFTMAX; kernel++) {
+        if (activation_service_stats_get(service, (enum coalesce_kernel)kernel, &stats) != 0 ||
+            stats.submissions == 0) {
+            continue;
+        }
+        printf("%-12s %zu requests in %zu batches, batch p50 %zu p99 %zu max %zu requests, "
+               "latency p50 %.1f p99 %.1f p99.9 %.1f max %.1f us\n",
+               kernel_names[kernel], stats.submissions, stats.batches, stats.batch_submissions_p50,
+               stats.batch_submissions_p99, stats.batch_submissions_max, stats.latency_p50_seconds * 1e6,
+               stats.latency_p99_seconds * 1e6, stats.latency_p999_seconds * 1e6, stats.latency_max_seconds * 1e6);
+    }
+    activation_service_stop(service);
+    thread_pool_destroy(pool);
+    return 0;
+}
@@ -0,0 +1,558 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "nn_func.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVICE_KERNEL_COUNT (COALESCE_SOFTMAX + 1)
+#define SERVICE_REQUIRED_SEALS (F_SEAL_SHRINK | F_SEAL_SEAL)
+#define SERVICE_MAX_CONNECTIONS 256
+
+/* Wire format, one SOCK_SEQPACKET message each way. The hello carries the
+   client's memfd as SCM_RIGHTS; offsets and lengths count doubles. */
+struct service_hello {
+    uint64_t capacity;
+};
+
+struct service_request {
+    uint32_t kernel;
+    uint32_t reserved;
+    uint64_t input_offset;
+    uint64_t output_offset;
+    uint64_t length;
+};
+
+struct service_reply {
+    int32_t status;
+};
+
+struct service_connection {
+    struct activation_service *service;
+    struct service_connection *next;
+    int socket_fd;
+};
+
+struct activation_service {
+    struct coalescer *coalescers[SERVICE_KERNEL_COUNT];
+    pthread_mutex_t mutex;
+    pthread_cond_t connections_done;
+    pthread_t accept_thread;
+    struct service_connection *connections;
+    int connection_count;
+    int listen_fd;
+    int bound;
+    int wake_pipe[2];
+    char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+};
+
+struct activation_client {
+    double *buffer;
+    size_t capacity;
+    int socket_fd;
+};
+
+static int service_address(const char *socket_path, struct sockaddr_un *address) {
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        return -1;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+    return 0;
+}
+
+static void service_reply_send(int socket_fd, int status) {
+    struct service_reply reply;
+
+    reply.status = status;
+    send(socket_fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+}
+
+/* A socket left at the path by a service that exited is removed; a path
+   where a service still accepts connections, or that is not a socket, makes
+   the start fail. */
+static int service_claim_path(const struct sockaddr_un *address) {
+    struct stat file_status;
+    int probe_fd;
+    int refused;
+
+    if (lstat(address->sun_path, &file_status) != 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (!S_ISSOCK(file_status.st_mode)) {
+        return -1;
+    }
+    probe_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (probe_fd == -1) {
+        return -1;
+    }
+    refused = connect(probe_fd, (const struct sockaddr *)address, sizeof(*address)) != 0 && errno == ECONNREFUSED;
+    close(probe_fd);
+    if (!refused) {
+        return -1;
+    }
+    return unlink(address->sun_path) == 0 || errno == ENOENT ? 0 : -1;
+}
+
+/* Takes the client's memfd from the hello and maps it. The shrink seal
+   stops the client from truncating the file under the mapping, which would
+   turn the service's next access into SIGBUS. */
+static double *service_map_client(int socket_fd, size_t *capacity) {
+    struct service_hello hello;
+    union {
+        struct cmsghdr header;
+        char bytes[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *message_header;
+    struct msghdr message;
+    struct iovec vector;
+    struct stat file_status;
+    void *mapping;
+    ssize_t received;
+    size_t fd_count;
+    size_t i;
+    int passed_fd;
+    int memory_fd;
+    int seals;
+
+    memset(&message, 0, sizeof(message));
+    vector.iov_base = &hello;
+    vector.iov_len = sizeof(hello);
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen = sizeof(control.bytes);
+    received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+    if (received == -1) {
+        return NULL;
+    }
+    /* Keep the descriptor only if it arrived alone; close every other
+       descriptor the client passed. */
+    memory_fd = -1;
+    for (message_header = CMSG_FIRSTHDR(&message); message_header != NULL;
+         message_header = CMSG_NXTHDR(&message, message_header)) {
+        if (message_header->cmsg_level != SOL_SOCKET || message_header->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        fd_count = (message_header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < fd_count; i++) {
+            memcpy(&passed_fd, CMSG_DATA(message_header) + i * sizeof(int), sizeof(int));
+            if (memory_fd == -1 && fd_count == 1) {
+                memory_fd = passed_fd;
+            } else {
+                close(passed_fd);
+            }
+        }
+    }
+    if (memory_fd == -1) {
+        return NULL;
+    }
+
+    mapping = MAP_FAILED;
+    seals = fcntl(memory_fd, F_GET_SEALS);
+    if (received == (ssize_t)sizeof(hello) && !(message.msg_flags & MSG_CTRUNC) && hello.capacity != 0 &&
+        hello.capacity <= SIZE_MAX / sizeof(double) && seals != -1 &&
+        (seals & SERVICE_REQUIRED_SEALS) == SERVICE_REQUIRED_SEALS && fstat(memory_fd, &file_status) == 0 &&
+        (uint64_t)file_status.st_size >= hello.capacity * sizeof(double)) {
+        mapping = mmap(NULL, (size_t)hello.capacity * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED,
+                       memory_fd, 0);
+    }
+    close(memory_fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    *capacity = (size_t)hello.capacity;
+    return mapping;
+}
+
+/* Both ranges must lie inside the segment, and they must be the same range
+   or not overlap at all. */
+static int service_request_valid(const struct service_request *request, size_t capacity) {
+    uint64_t input_end;
+    uint64_t output_end;
+
+    if (request->kernel >= SERVICE_KERNEL_COUNT || request->length > capacity ||
+        request->input_offset > capacity - request->length || request->output_offset > capacity - request->length) {
+        return 0;
+    }
+    input_end = request->input_offset + request->length;
+    output_end = request->output_offset + request->length;
+    return request->input_offset == request->output_offset || input_end <= request->output_offset ||
+           output_end <= request->input_offset;
+}
+
+static void service_connection_remove(struct service_connection *connection) {
+    struct activation_service *service = connection->service;
+    struct service_connection **link;
+
+    pthread_mutex_lock(&service->mutex);
+    for (link = &service->connections; *link != NULL; link = &(*link)->next) {
+        if (*link == connection) {
+            *link = connection->next;
+            break;
+        }
+    }
+    service->connection_count--;
+    pthread_cond_signal(&service->connections_done);
+    pthread_mutex_unlock(&service->mutex);
+    close(connection->socket_fd);
+    free(connection);
+}
+
+static void *service_connection_run(void *argument) {
+    struct service_connection *connection = argument;
+    struct service_request request;
+    double *buffer;
+    size_t capacity;
+    ssize_t received;
+
+    buffer = service_map_client(connection->socket_fd, &capacity);
+    service_reply_send(connection->socket_fd, buffer != NULL ? 0 : -1);
+    while (buffer != NULL) {
+        received = recv(connection->socket_fd, &request, sizeof(request), 0);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received != (ssize_t)sizeof(request)) {
+            break;
+        }
+        if (!service_request_valid(&request, capacity)) {
+            service_reply_send(connection->socket_fd, -1);
+            continue;
+        }
+        coalescer_submit(connection->service->coalescers[request.kernel], buffer + request.input_offset,
+                         buffer + request.output_offset, (size_t)request.length);
+        service_reply_send(connection->socket_fd, 0);
+    }
+    if (buffer != NULL) {
+        munmap(buffer, capacity * sizeof(double));
+    }
+    service_connection_remove(connection);
+    return NULL;
+}
+
+static void *service_accept_run(void *argument) {
+    struct activation_service *service = argument;
+    struct service_connection *connection;
+    struct pollfd descriptors[2];
+    pthread_attr_t attributes;
+    pthread_t thread;
+    int socket_fd;
+
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    descriptors[0].fd = service->listen_fd;
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = service->wake_pipe[0];
+    descriptors[1].events = POLLIN;
+    for (;;) {
+        if (poll(descriptors, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (descriptors[1].revents != 0) {
+            break;
+        }
+        socket_fd = accept4(service->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (socket_fd == -1) {
+            continue;
+        }
+        pthread_mutex_lock(&service->mutex);
+        connection = NULL;
+        if (service->connection_count < SERVICE_MAX_CONNECTIONS) {
+            connection = malloc(sizeof(*connection));
+        }
+        if (connection == NULL) {
+            pthread_mutex_unlock(&service->mutex);
+            close(socket_fd);
+            continue;
+        }
+        connection->service = service;
+        connection->socket_fd = socket_fd;
+        connection->next = service->connections;
+        service->connections = connection;
+        service->connection_count++;
+        pthread_mutex_unlock(&service->mutex);
+        if (pthread_create(&thread, &attributes, service_connection_run, connection) != 0) {
+            service_connection_remove(connection);
+        }
+    }
+    pthread_attr_destroy(&attributes);
+    return NULL;
+}
+
+static void service_free(struct activation_service *service) {
+    int kernel;
+
+    for (kernel = 0; kernel < SERVICE_KERNEL_COUNT; kernel++) {
+        coalescer_destroy(service->coalescers[kernel]);
+    }
+    if (service->listen_fd != -1) {
+        close(service->listen_fd);
+    }
+    if (service->bound) {
+        unlink(service->socket_path);
+    }
+    if (service->wake_pipe[0] != -1) {
+        close(service->wake_pipe[0]);
+        close(service->wake_pipe[1]);
+    }
+    pthread_cond_destroy(&service->connections_done);
+    pthread_mutex_destroy(&service->mutex);
+    free(service);
+}
+
+struct activation_service *activation_service_start(const char *socket_path, struct thread_pool *pool,
+                                                    size_t max_batch_elements, double budget_seconds) {
+    struct activation_service *service;
+    struct sockaddr_un address;
+    int kernel;
+
+    if (service_address(socket_path, &address) != 0) {
+        return NULL;
+    }
+    service = calloc(1, sizeof(*service));
+    if (service == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&service->mutex, NULL);
+    pthread_cond_init(&service->connections_done, NULL);
+    service->listen_fd = -1;
+    service->wake_pipe[0] = -1;
+    service->wake_pipe[1] = -1;
+    strcpy(service->socket_path, socket_path);
+    for (kernel = 0; kernel < SERVICE_KERNEL_COUNT; kernel++) {
+        service->coalescers[kernel] =
+            coalescer_create((enum coalesce_kernel)kernel, pool, max_batch_elements, budget_seconds);
+        if (service->coalescers[kernel] == NULL) {
+            service_free(service);
+            return NULL;
+        }
+    }
+    if (pipe2(service->wake_pipe, O_CLOEXEC) != 0) {
+        service->wake_pipe[0] = -1;
+        service_free(service);
+        return NULL;
+    }
+    service->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (service->listen_fd == -1) {
+        service_free(service);
+        return NULL;
+    }
+    if (service_claim_path(&address) != 0 ||
+        bind(service->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        service_free(service);
+        return NULL;
+    }
+    service->bound = 1;
+    if (listen(service->listen_fd, SOMAXCONN) != 0 ||
+        pthread_create(&service->accept_thread, NULL, service_accept_run, service) != 0) {
+        service_free(service);
+        return NULL;
+    }
+    return service;
+}
+
+void activation_service_stop(struct activation_service *service) {
+    struct service_connection *connection;
+    char wake;
+
+    if (service == NULL) {
+        return;
+    }
+    wake = 1;
+    while (write(service->wake_pipe[1], &wake, 1) == -1 && errno == EINTR) {
+    }
+    pthread_join(service->accept_thread, NULL);
+    pthread_mutex_lock(&service->mutex);
+    for (connection = service->connections; connection != NULL; connection = connection->next) {
+        shutdown(connection->socket_fd, SHUT_RDWR);
+    }
+    while (service->connection_count > 0) {
+        pthread_cond_wait(&service->connections_done, &service->mutex);
+    }
+    pthread_mutex_unlock(&service->mutex);
+    service_free(service);
+}
+
+int activation_service_stats_get(struct activation_service *service, enum coalesce_kernel kernel,
+                                 struct coalescer_stats *stats) {
+    if ((unsigned int)kernel >= SERVICE_KERNEL_COUNT) {
+        return -1;
+    }
+    coalescer_stats_get(service->coalescers[kernel], stats);
+    return 0;
+}
+
+struct activation_client *activation_client_connect(const char *socket_path, size_t capacity) {
+    struct activation_client *client;
+    struct service_hello hello;
+    struct service_reply reply;
+    union {
+        struct cmsghdr header;
+        char bytes[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *message_header;
+    struct sockaddr_un address;
+    struct msghdr message;
+    struct iovec vector;
+    void *mapping;
+    int memory_fd;
+    int socket_fd;
+
+    if (capacity == 0 || capacity > SIZE_MAX / sizeof(double) || service_address(socket_path, &address) != 0) {
+        return NULL;
+    }
+    memory_fd = memfd_create("nn_func_client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memory_fd == -1) {
+        return NULL;
+    }
+    mapping = MAP_FAILED;
+    if (ftruncate(memory_fd, (off_t)(capacity * sizeof(double))) == 0 &&
+        fcntl(memory_fd, F_ADD_SEALS, SERVICE_REQUIRED_SEALS) == 0) {
+        mapping = mmap(NULL, capacity * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+    }
+    socket_fd = -1;
+    if (mapping != MAP_FAILED) {
+        socket_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    }
+    if (socket_fd != -1 && connect(socket_fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        hello.capacity = capacity;
+        memset(&message, 0, sizeof(message));
+        vector.iov_base = &hello;
+        vector.iov_len = sizeof(hello);
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.bytes;
+        message.msg_controllen = sizeof(control.bytes);
+        message_header = CMSG_FIRSTHDR(&message);
+        message_header->cmsg_level = SOL_SOCKET;
+        message_header->cmsg_type = SCM_RIGHTS;
+        message_header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(message_header), &memory_fd, sizeof(int));
+        if (sendmsg(socket_fd, &message, MSG_NOSIGNAL) == (ssize_t)sizeof(hello) &&
+            recv(socket_fd, &reply, sizeof(reply), 0) == (ssize_t)sizeof(reply) && reply.status == 0) {
+            close(memory_fd);
+            client = malloc(sizeof(*client));
+            if (client != NULL) {
+                client->buffer = mapping;
+                client->capacity = capacity;
+                client->socket_fd = socket_fd;
+                return client;
+            }
+            memory_fd = -1;
+        }
+    }
+    if (socket_fd != -1) {
+        close(socket_fd);
+    }
+    if (mapping != MAP_FAILED) {
+        munmap(mapping, capacity * sizeof(double));
+    }
+    if (memory_fd != -1) {
+        close(memory_fd);
+    }
+    return NULL;
+}
+
+double *activation_client_buffer(struct activation_client *client) {
+    return client->buffer;
+}
+
+int activation_client_run(struct activation_client *client, enum coalesce_kernel kernel, size_t input_offset,
+                          size_t output_offset, size_t length) {
+    struct service_request request;
+    struct service_reply reply;
+    ssize_t received;
+
+    memset(&request, 0, sizeof(request));
+    request.kernel = (uint32_t)kernel;
+    request.input_offset = input_offset;
+    request.output_offset = output_offset;
+    request.length = length;
+    if (send(client->socket_fd, &request, sizeof(request), MSG_NOSIGNAL) != (ssize_t)sizeof(request)) {
+        return -1;
+    }
+    do {
+        received = recv(client->socket_fd, &reply, sizeof(reply), 0);
+    } while (received == -1 && errno == EINTR);
+    if (received != (ssize_t)sizeof(reply)) {
+        return -1;
+    }
+    return reply.status;
+}
+
+void activation_client_close(struct activation_client *client) {
+    if (client == NULL) {
+        return;
+    }
+    close(client->socket_fd);
+    munmap(client->buffer, client->capacity * sizeof(double));
+    free(client);
+}
+
+#else
+
+struct activation_service *activation_service_start(const char *socket_path, struct thread_pool *pool,
+                                                    size_t max_batch_elements, double budget_seconds) {
+    (void)socket_path;
+    (void)pool;
+    (void)max_batch_elements;
+    (void)budget_seconds;
+    return NULL;
+}
+
+void activation_service_stop(struct activation_service *service) {
+    (void)service;
+}
+
+int activation_service_stats_get(struct activation_service *service, enum coalesce_kernel kernel,
+                                 struct coalescer_stats *stats) {
+    (void)service;
+    (void)kernel;
+    (void)stats;
+    return -1;
+}
+
+struct activation_client *activation_client_connect(const char *socket_path, size_t capacity) {
+    (void)socket_path;
+    (void)capacity;
+    return NULL;
+}
+
+double *activation_client_buffer(struct activation_client *client) {
+    (void)client;
+    return NULL;
+}
+
+int activation_client_run(struct activation_client *client, enum coalesce_kernel kernel, size_t input_offset,
+                          size_t output_offset, size_t length) {
+    (void)client;
+    (void)kernel;
+    (void)input_offset;
+    (void)output_offset;
+    (void)length;
+    return -1;
+}
+
+void activation_client_close(struct activation_client *client) {
+    (void)client;
+}
+
+#endif
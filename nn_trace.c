@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nn_func.h"
+#include "nn_trace.h"
+
+#ifdef NN_FUNC_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_HAS_RDTSC
+#endif
+
+#define TRACE_BUFFER_EVENTS 65536
+
+struct trace_event {
+    const char *name;
+    uint64_t start_ticks;
+    uint64_t end_ticks;
+    int thread_id;
+};
+
+/* Only the owning thread writes events; it publishes them by a release store
+   of event_count, which trace_write_json reads with an acquire load. Buffers
+   are pushed onto trace_buffers with a CAS and stay there. When a thread
+   exits, a pthread key destructor puts its buffer on free_buffers for the
+   next new thread, so there are never more buffers than threads alive at
+   once. Events carry their thread's id because a buffer can hold events from
+   several threads in turn. */
+struct trace_buffer {
+    struct trace_event events[TRACE_BUFFER_EVENTS];
+    struct trace_buffer *next;
+    struct trace_buffer *free_next;
+    size_t event_count;
+    size_t dropped_count;
+    int thread_id;
+};
+
+static struct trace_buffer *trace_buffers;
+static struct trace_buffer *free_buffers;
+static pthread_mutex_t free_buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buffer_key;
+static int trace_enabled;
+static int trace_thread_count;
+static uint64_t trace_origin_ticks;
+static double trace_origin_seconds;
+static _Thread_local struct trace_buffer *thread_buffer;
+
+static uint64_t trace_ticks(void) {
+#ifdef TRACE_HAS_RDTSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static double trace_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void trace_buffer_release(void *argument) {
+    struct trace_buffer *buffer = argument;
+
+    pthread_mutex_lock(&free_buffers_mutex);
+    buffer->free_next = free_buffers;
+    free_buffers = buffer;
+    pthread_mutex_unlock(&free_buffers_mutex);
+}
+
+static void trace_buffer_key_create(void) {
+    pthread_key_create(&buffer_key, trace_buffer_release);
+}
+
+static struct trace_buffer *trace_thread_buffer(void) {
+    struct trace_buffer *buffer;
+
+    if (thread_buffer != NULL) {
+        return thread_buffer;
+    }
+    pthread_once(&buffer_key_once, trace_buffer_key_create);
+    pthread_mutex_lock(&free_buffers_mutex);
+    buffer = free_buffers;
+    if (buffer != NULL) {
+        free_buffers = buffer->free_next;
+    }
+    pthread_mutex_unlock(&free_buffers_mutex);
+    if (buffer == NULL) {
+        buffer = calloc(1, sizeof(*buffer));
+        if (buffer == NULL) {
+            return NULL;
+        }
+        buffer->next = __atomic_load_n(&trace_buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&trace_buffers, &buffer->next, buffer, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    buffer->thread_id = __atomic_add_fetch(&trace_thread_count, 1, __ATOMIC_RELAXED);
+    pthread_setspecific(buffer_key, buffer);
+    thread_buffer = buffer;
+    return buffer;
+}
+
+void trace_enable(int enabled) {
+    if (enabled && !__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED)) {
+        trace_origin_seconds = trace_seconds();
+        trace_origin_ticks = trace_ticks();
+    }
+    __atomic_store_n(&trace_enabled, enabled != 0, __ATOMIC_RELEASE);
+}
+
+uint64_t trace_begin(void) {
+    if (!__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return trace_ticks();
+}
+
+void trace_end(const char *name, uint64_t start_ticks) {
+    struct trace_buffer *buffer;
+    struct trace_event *event;
+    uint64_t end_ticks;
+    size_t count;
+
+    if (start_ticks == 0) {
+        return;
+    }
+    end_ticks = trace_ticks();
+    buffer = trace_thread_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    count = buffer->event_count;
+    if (count == TRACE_BUFFER_EVENTS) {
+        buffer->dropped_count++;
+        return;
+    }
+    event = &buffer->events[count];
+    event->name = name;
+    event->start_ticks = start_ticks;
+    event->end_ticks = end_ticks;
+    event->thread_id = buffer->thread_id;
+    __atomic_store_n(&buffer->event_count, count + 1, __ATOMIC_RELEASE);
+}
+
+int trace_write_json(const char *path) {
+    struct trace_buffer *buffer;
+    struct trace_event *event;
+    FILE *file;
+    double ticks_per_microsecond;
+    double elapsed;
+    size_t dropped;
+    size_t count;
+    size_t i;
+    int first;
+    int failed;
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    elapsed = trace_seconds() - trace_origin_seconds;
+    ticks_per_microsecond = 1.0;
+    if (elapsed > 0.0) {
+        ticks_per_microsecond = (double)(trace_ticks() - trace_origin_ticks) / (elapsed * 1e6);
+    }
+    if (!(ticks_per_microsecond > 0.0)) {
+        ticks_per_microsecond = 1.0;
+    }
+
+    fprintf(file, "{\"traceEvents\":[");
+    first = 1;
+    dropped = 0;
+    for (buffer = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE); buffer != NULL; buffer = buffer->next) {
+        count = __atomic_load_n(&buffer->event_count, __ATOMIC_ACQUIRE);
+        for (i = 0; i < count; i++) {
+            event = &buffer->events[i];
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",", event->name, event->thread_id,
+                    (double)(int64_t)(event->start_ticks - trace_origin_ticks) / ticks_per_microsecond,
+                    (double)(event->end_ticks - event->start_ticks) / ticks_per_microsecond);
+            first = 0;
+        }
+        dropped += buffer->dropped_count;
+        buffer->dropped_count = 0;
+        __atomic_store_n(&buffer->event_count, 0, __ATOMIC_RELEASE);
+    }
+    fprintf(file, "\n],\"otherData\":{\"dropped_events\":%zu}}\n", dropped);
+    failed = ferror(file);
+    if (fclose(file) != 0) {
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+#else
+
+void trace_enable(int enabled) {
+    (void)enabled;
+}
+
+int trace_write_json(const char *path) {
+    (void)path;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef NN_TRACE_H
+#define NN_TRACE_H
+
+/* Internal tracing hooks. Built with -DNN_FUNC_TRACE they record one complete
+   event per TRACE_BEGIN/TRACE_END pair, named after the enclosing function;
+   otherwise they expand to nothing. TRACE_BEGIN() declares a local, so it goes
+   last among a block's declarations. */
+
+#ifdef NN_FUNC_TRACE
+
+#include <stdint.h>
+
+uint64_t trace_begin(void);
+void trace_end(const char *name, uint64_t start_ticks);
+
+#define TRACE_BEGIN() uint64_t trace_start_ticks = trace_begin()
+#define TRACE_END() trace_end(__func__, trace_start_ticks)
+#define TRACE_END_NAMED(name) trace_end(name, trace_start_ticks)
+
+#else
+
+#define TRACE_BEGIN()
+#define TRACE_END()
+#define TRACE_END_NAMED(name)
+
+#endif
+
+#endif
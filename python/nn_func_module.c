@@ -0,0 +1,505 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stddef.h>
+#include <string.h>
+
+#include "nn_func.h"
+
+/* CPython bindings for the element-wise kernels and softmax. Arguments are
+   any objects exporting the buffer protocol (NumPy arrays, memoryviews,
+   array.array) of float64 or float32, in any shape and with any strides.
+   The kernels run along the last axis with the GIL released. float64 data
+   is used in place; float32 data goes through a double buffer of
+   MODULE_CHUNK elements. */
+
+#define MODULE_CHUNK 512
+
+typedef void (*module_contiguous_kernel)(const double *input, double *output, size_t length, double alpha);
+typedef void (*module_strided_kernel)(const double *input, ptrdiff_t input_stride, double *output,
+                                      ptrdiff_t output_stride, size_t length, double alpha);
+
+struct module_kernel {
+    const char *name;
+    module_contiguous_kernel contiguous;
+    module_strided_kernel strided;
+    int takes_alpha;
+    double default_alpha;
+};
+
+#define MODULE_WRAP(name)                                                                                    \
+    static void module_##name##_contiguous(const double *input, double *output, size_t length, double alpha) { \
+        (void)alpha;                                                                                         \
+        name##_array(input, output, length);                                                                 \
+    }                                                                                                        \
+    static void module_##name##_strided(const double *input, ptrdiff_t input_stride, double *output,         \
+                                        ptrdiff_t output_stride, size_t length, double alpha) {              \
+        (void)alpha;                                                                                         \
+        name##_array_strided(input, input_stride, output, output_stride, length);                            \
+    }
+
+#define MODULE_WRAP_ALPHA(name)                                                                              \
+    static void module_##name##_contiguous(const double *input, double *output, size_t length, double alpha) { \
+        name##_array(input, output, length, alpha);                                                          \
+    }                                                                                                        \
+    static void module_##name##_strided(const double *input, ptrdiff_t input_stride, double *output,         \
+                                        ptrdiff_t output_stride, size_t length, double alpha) {              \
+        name##_array_strided(input, input_stride, output, output_stride, length, alpha);                     \
+    }
+
+MODULE_WRAP(sigmoid)
+MODULE_WRAP(sigmoid_derivative)
+MODULE_WRAP(tanh)
+MODULE_WRAP(tanh_derivative)
+MODULE_WRAP(relu)
+MODULE_WRAP(relu_derivative)
+MODULE_WRAP(leaky_relu)
+MODULE_WRAP_ALPHA(leaky_relu_derivative)
+MODULE_WRAP(hard_sigmoid)
+MODULE_WRAP(hard_sigmoid_derivative)
+MODULE_WRAP_ALPHA(elu)
+MODULE_WRAP_ALPHA(elu_derivative)
+MODULE_WRAP(swish)
+MODULE_WRAP(swish_derivative)
+
+#define MODULE_KERNEL(name, takes_alpha, default_alpha) \
+    {#name, module_##name##_contiguous, module_##name##_strided, takes_alpha, default_alpha}
+
+static const struct module_kernel module_kernels[] = {
+    MODULE_KERNEL(sigmoid, 0, 0.0),
+    MODULE_KERNEL(sigmoid_derivative, 0, 0.0),
+    MODULE_KERNEL(tanh, 0, 0.0),
+    MODULE_KERNEL(tanh_derivative, 0, 0.0),
+    MODULE_KERNEL(relu, 0, 0.0),
+    MODULE_KERNEL(relu_derivative, 0, 0.0),
+    MODULE_KERNEL(leaky_relu, 0, 0.0),
+    MODULE_KERNEL(leaky_relu_derivative, 1, 0.01),
+    MODULE_KERNEL(hard_sigmoid, 0, 0.0),
+    MODULE_KERNEL(hard_sigmoid_derivative, 0, 0.0),
+    MODULE_KERNEL(elu, 1, 1.0),
+    MODULE_KERNEL(elu_derivative, 1, 1.0),
+    MODULE_KERNEL(swish, 0, 0.0),
+    MODULE_KERNEL(swish_derivative, 0, 0.0),
+};
+
+#define MODULE_KERNEL_COUNT ((int)(sizeof(module_kernels) / sizeof(module_kernels[0])))
+
+/* One row along the last axis. Strides count bytes. */
+struct module_row {
+    char *input;
+    char *output;
+    Py_ssize_t input_stride;
+    Py_ssize_t output_stride;
+    Py_ssize_t length;
+};
+
+/* Returns 'd' or 'f' for native float64 or float32 buffers, 0 otherwise. */
+static char module_format(const Py_buffer *view) {
+    const char *format;
+
+    format = view->format != NULL ? view->format : "B";
+    if (format[0] == '@' || format[0] == '=' || (format[0] == '<' && PY_LITTLE_ENDIAN) ||
+        (format[0] == '>' && !PY_LITTLE_ENDIAN)) {
+        format++;
+    }
+    if (strcmp(format, "d") == 0 && view->itemsize == sizeof(double)) {
+        return 'd';
+    }
+    if (strcmp(format, "f") == 0 && view->itemsize == sizeof(float)) {
+        return 'f';
+    }
+    return 0;
+}
+
+static void module_extent(const Py_buffer *view, char **low, char **high) {
+    Py_ssize_t step;
+    int d;
+
+    *low = view->buf;
+    *high = (char *)view->buf + view->itemsize;
+    for (d = 0; d < view->ndim; d++) {
+        step = (view->shape[d] - 1) * view->strides[d];
+        if (step < 0) {
+            *low += step;
+        } else {
+            *high += step;
+        }
+    }
+}
+
+static int module_same_layout(const Py_buffer *input, const Py_buffer *output) {
+    int d;
+
+    if (input->buf != output->buf) {
+        return 0;
+    }
+    for (d = 0; d < input->ndim; d++) {
+        if (input->strides[d] != output->strides[d]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Checks that output can receive the result for input: same shape and
+   format, element-aligned strides, and either exactly input itself or no
+   shared memory at all. */
+static int module_check_views(const Py_buffer *input, const Py_buffer *output) {
+    char *input_low;
+    char *input_high;
+    char *output_low;
+    char *output_high;
+    int d;
+
+    if (module_format(input) == 0) {
+        PyErr_SetString(PyExc_TypeError, "expected a float64 or float32 buffer");
+        return -1;
+    }
+    if (module_format(output) != module_format(input)) {
+        PyErr_SetString(PyExc_TypeError, "out must have the same dtype as x");
+        return -1;
+    }
+    if (output->ndim != input->ndim) {
+        PyErr_SetString(PyExc_ValueError, "out must have the same shape as x");
+        return -1;
+    }
+    for (d = 0; d < input->ndim; d++) {
+        if (output->shape[d] != input->shape[d]) {
+            PyErr_SetString(PyExc_ValueError, "out must have the same shape as x");
+            return -1;
+        }
+        if (input->strides[d] % input->itemsize != 0 || output->strides[d] % output->itemsize != 0) {
+            PyErr_SetString(PyExc_ValueError, "strides must be multiples of the item size");
+            return -1;
+        }
+    }
+    if (input->len == 0 || module_same_layout(input, output)) {
+        return 0;
+    }
+    module_extent(input, &input_low, &input_high);
+    module_extent(output, &output_low, &output_high);
+    if (input_low < output_high && output_low < input_high) {
+        PyErr_SetString(PyExc_ValueError, "out must be x itself or not overlap it");
+        return -1;
+    }
+    return 0;
+}
+
+/* Calls row_function on every row along the last axis. A 0-d buffer is one
+   row of one element. Runs without the GIL. */
+static void module_for_each_row(const Py_buffer *input, const Py_buffer *output,
+                                void (*row_function)(const struct module_row *row, void *context), void *context) {
+    Py_ssize_t index[PyBUF_MAX_NDIM];
+    struct module_row row;
+    int last;
+    int d;
+
+    if (input->len == 0) {
+        return;
+    }
+    if (input->ndim == 0) {
+        row.input = input->buf;
+        row.output = output->buf;
+        row.input_stride = input->itemsize;
+        row.output_stride = output->itemsize;
+        row.length = 1;
+        row_function(&row, context);
+        return;
+    }
+    last = input->ndim - 1;
+    row.input_stride = input->strides[last];
+    row.output_stride = output->strides[last];
+    row.length = input->shape[last];
+    memset(index, 0, sizeof(index));
+    for (;;) {
+        row.input = input->buf;
+        row.output = output->buf;
+        for (d = 0; d < last; d++) {
+            row.input += index[d] * input->strides[d];
+            row.output += index[d] * output->strides[d];
+        }
+        row_function(&row, context);
+        for (d = last - 1; d >= 0; d--) {
+            index[d]++;
+            if (index[d] < input->shape[d]) {
+                break;
+            }
+            index[d] = 0;
+        }
+        if (d < 0) {
+            return;
+        }
+    }
+}
+
+struct module_elementwise {
+    const struct module_kernel *kernel;
+    double alpha;
+    char format;
+};
+
+static void module_elementwise_row(const struct module_row *row, void *context) {
+    struct module_elementwise *elementwise = context;
+    double chunk[MODULE_CHUNK];
+    Py_ssize_t input_stride;
+    Py_ssize_t output_stride;
+    Py_ssize_t start;
+    Py_ssize_t count;
+    Py_ssize_t i;
+
+    if (elementwise->format == 'd') {
+        input_stride = row->input_stride / (Py_ssize_t)sizeof(double);
+        output_stride = row->output_stride / (Py_ssize_t)sizeof(double);
+        if (input_stride == 1 && output_stride == 1) {
+            elementwise->kernel->contiguous((const double *)row->input, (double *)row->output, (size_t)row->length,
+                                            elementwise->alpha);
+        } else {
+            elementwise->kernel->strided((const double *)row->input, input_stride, (double *)row->output,
+                                         output_stride, (size_t)row->length, elementwise->alpha);
+        }
+        return;
+    }
+    for (start = 0; start < row->length; start += MODULE_CHUNK) {
+        count = row->length - start < MODULE_CHUNK ? row->length - start : MODULE_CHUNK;
+        for (i = 0; i < count; i++) {
+            chunk[i] = *(const float *)(row->input + (start + i) * row->input_stride);
+        }
+        elementwise->kernel->contiguous(chunk, chunk, (size_t)count, elementwise->alpha);
+        for (i = 0; i < count; i++) {
+            *(float *)(row->output + (start + i) * row->output_stride) = (float)chunk[i];
+        }
+    }
+}
+
+struct module_softmax {
+    double *row_buffer;
+    char format;
+};
+
+static void module_softmax_row(const struct module_row *row, void *context) {
+    struct module_softmax *softmax_context = context;
+    double *buffer;
+    Py_ssize_t i;
+
+    if (softmax_context->format == 'd' && row->input_stride == sizeof(double) &&
+        row->output_stride == sizeof(double)) {
+        softmax((const double *)row->input, (double *)row->output, (size_t)row->length);
+        return;
+    }
+    buffer = softmax_context->row_buffer;
+    for (i = 0; i < row->length; i++) {
+        buffer[i] = softmax_context->format == 'd' ? *(const double *)(row->input + i * row->input_stride)
+                                                   : *(const float *)(row->input + i * row->input_stride);
+    }
+    softmax(buffer, buffer, (size_t)row->length);
+    for (i = 0; i < row->length; i++) {
+        if (softmax_context->format == 'd') {
+            *(double *)(row->output + i * row->output_stride) = buffer[i];
+        } else {
+            *(float *)(row->output + i * row->output_stride) = (float)buffer[i];
+        }
+    }
+}
+
+/* Allocates the result for out=None: a NumPy array when NumPy is installed,
+   otherwise a memoryview over a new bytearray. Both are C-contiguous. */
+static PyObject *module_new_output(const Py_buffer *input) {
+    PyObject *shape;
+    PyObject *numpy;
+    PyObject *bytes;
+    PyObject *view;
+    PyObject *result;
+    const char *format;
+    int d;
+
+    format = module_format(input) == 'd' ? "d" : "f";
+    shape = PyTuple_New(input->ndim);
+    if (shape == NULL) {
+        return NULL;
+    }
+    for (d = 0; d < input->ndim; d++) {
+        PyTuple_SET_ITEM(shape, d, PyLong_FromSsize_t(input->shape[d]));
+    }
+    numpy = PyImport_ImportModule("numpy");
+    if (numpy != NULL) {
+        result = PyObject_CallMethod(numpy, "empty", "Os", shape, format);
+        Py_DECREF(numpy);
+        Py_DECREF(shape);
+        return result;
+    }
+    PyErr_Clear();
+    bytes = PyByteArray_FromStringAndSize(NULL, input->len);
+    view = bytes != NULL ? PyMemoryView_FromObject(bytes) : NULL;
+    Py_XDECREF(bytes);
+    result = view != NULL ? PyObject_CallMethod(view, "cast", "sO", format, shape) : NULL;
+    Py_XDECREF(view);
+    Py_DECREF(shape);
+    return result;
+}
+
+/* Shared argument handling: gets a read view of x and a writable view of
+   out, allocating out when it is None. Returns a new reference to out. */
+static PyObject *module_open_views(PyObject *input_object, PyObject *output_object, Py_buffer *input,
+                                   Py_buffer *output) {
+    if (PyObject_GetBuffer(input_object, input, PyBUF_RECORDS_RO) != 0) {
+        return NULL;
+    }
+    if (module_format(input) == 0) {
+        PyErr_SetString(PyExc_TypeError, "expected a float64 or float32 buffer");
+        PyBuffer_Release(input);
+        return NULL;
+    }
+    if (output_object == NULL || output_object == Py_None) {
+        output_object = module_new_output(input);
+        if (output_object == NULL) {
+            PyBuffer_Release(input);
+            return NULL;
+        }
+    } else {
+        Py_INCREF(output_object);
+    }
+    if (PyObject_GetBuffer(output_object, output, PyBUF_RECORDS) != 0) {
+        Py_DECREF(output_object);
+        PyBuffer_Release(input);
+        return NULL;
+    }
+    if (module_check_views(input, output) != 0) {
+        PyBuffer_Release(output);
+        Py_DECREF(output_object);
+        PyBuffer_Release(input);
+        return NULL;
+    }
+    return output_object;
+}
+
+static PyObject *module_elementwise_call(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *alpha_keywords[] = {"x", "alpha", "out", NULL};
+    static char *keywords[] = {"x", "out", NULL};
+    struct module_elementwise elementwise;
+    Py_buffer input;
+    Py_buffer output;
+    PyObject *input_object;
+    PyObject *output_object;
+    PyObject *result;
+    int index;
+
+    index = (int)PyLong_AsLong(self);
+    elementwise.kernel = &module_kernels[index];
+    elementwise.alpha = elementwise.kernel->default_alpha;
+    output_object = NULL;
+    if (elementwise.kernel->takes_alpha) {
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|dO", alpha_keywords, &input_object, &elementwise.alpha,
+                                         &output_object)) {
+            return NULL;
+        }
+    } else if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", keywords, &input_object, &output_object)) {
+        return NULL;
+    }
+    result = module_open_views(input_object, output_object, &input, &output);
+    if (result == NULL) {
+        return NULL;
+    }
+    elementwise.format = module_format(&input);
+    Py_BEGIN_ALLOW_THREADS
+    module_for_each_row(&input, &output, module_elementwise_row, &elementwise);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&output);
+    PyBuffer_Release(&input);
+    return result;
+}
+
+static PyObject *module_softmax_call(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"x", "out", NULL};
+    struct module_softmax softmax_context;
+    Py_buffer input;
+    Py_buffer output;
+    PyObject *input_object;
+    PyObject *output_object;
+    PyObject *result;
+    Py_ssize_t row_length;
+
+    (void)self;
+    output_object = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", keywords, &input_object, &output_object)) {
+        return NULL;
+    }
+    result = module_open_views(input_object, output_object, &input, &output);
+    if (result == NULL) {
+        return NULL;
+    }
+    softmax_context.format = module_format(&input);
+    row_length = input.ndim > 0 ? input.shape[input.ndim - 1] : 1;
+    softmax_context.row_buffer = PyMem_RawMalloc((size_t)(row_length > 0 ? row_length : 1) * sizeof(double));
+    if (softmax_context.row_buffer == NULL) {
+        PyBuffer_Release(&output);
+        PyBuffer_Release(&input);
+        Py_DECREF(result);
+        return PyErr_NoMemory();
+    }
+    Py_BEGIN_ALLOW_THREADS
+    if (softmax_context.format == 'd' && input.ndim > 0 && input.len > 0 && PyBuffer_IsContiguous(&input, 'C') &&
+        PyBuffer_IsContiguous(&output, 'C')) {
+        softmax_rows(input.buf, output.buf, (size_t)(input.len / input.itemsize / row_length), (size_t)row_length);
+    } else {
+        module_for_each_row(&input, &output, module_softmax_row, &softmax_context);
+    }
+    Py_END_ALLOW_THREADS
+    PyMem_RawFree(softmax_context.row_buffer);
+    PyBuffer_Release(&output);
+    PyBuffer_Release(&input);
+    return result;
+}
+
+static PyMethodDef module_softmax_method = {
+    "softmax", (PyCFunction)(void (*)(void))module_softmax_call, METH_VARARGS | METH_KEYWORDS,
+    "softmax(x, out=None)\n--\n\nSoftmax along the last axis of a float64 or float32 buffer.",
+};
+
+static PyMethodDef module_kernel_methods[MODULE_KERNEL_COUNT];
+
+static struct PyModuleDef module_definition = {
+    PyModuleDef_HEAD_INIT,
+    "nn_func",
+    "Batched activation kernels from libnn_func over buffer-protocol objects.\n\n"
+    "Each function takes x, a float64 or float32 buffer of any shape and strides,\n"
+    "and writes to out, which must match x in shape and dtype and be x itself or\n"
+    "not overlap it. Without out a new C-contiguous array is returned (a NumPy\n"
+    "array when NumPy is installed). The GIL is released while the kernel runs.",
+    -1,
+    NULL,
+};
+
+PyMODINIT_FUNC PyInit_nn_func(void) {
+    PyObject *module;
+    PyObject *index;
+    PyObject *function;
+    int i;
+
+    module = PyModule_Create(&module_definition);
+    if (module == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < MODULE_KERNEL_COUNT; i++) {
+        module_kernel_methods[i].ml_name = module_kernels[i].name;
+        module_kernel_methods[i].ml_meth = (PyCFunction)(void (*)(void))module_elementwise_call;
+        module_kernel_methods[i].ml_flags = METH_VARARGS | METH_KEYWORDS;
+        module_kernel_methods[i].ml_doc = module_kernels[i].takes_alpha
+                                              ? "(x, alpha, out=None): element-wise kernel with parameter alpha."
+                                              : "(x, out=None): element-wise kernel.";
+        index = PyLong_FromLong(i);
+        function = index != NULL ? PyCFunction_NewEx(&module_kernel_methods[i], index, NULL) : NULL;
+        Py_XDECREF(index);
+        if (function == NULL || PyModule_AddObject(module, module_kernels[i].name, function) != 0) {
+            Py_XDECREF(function);
+            Py_DECREF(module);
+            return NULL;
+        }
+    }
+    function = PyCFunction_NewEx(&module_softmax_method, NULL, NULL);
+    if (function == NULL || PyModule_AddObject(module, "softmax", function) != 0) {
+        Py_XDECREF(function);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
@@ -0,0 +1,1541 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nn_func.h"
+
+/* Kernel-versus-scalar comparisons and finite-difference gradient checks.
+   Run with "make check"; exits non-zero if any check fails. */
+
+#define TEST_LENGTH 1237
+#define GRADIENT_STEP 1e-5
+#define GRADIENT_TOLERANCE 1e-6
+
+static int failures;
+static int checks;
+
+#define CHECK(condition, ...)                                        \
+    do {                                                             \
+        checks++;                                                    \
+        if (!(condition)) {                                          \
+            failures++;                                              \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);     \
+            fprintf(stderr, __VA_ARGS__);                            \
+            fprintf(stderr, "\n");                                   \
+        }                                                            \
+    } while (0)
+
+static int same_value(double a, double b) {
+    return a == b || (a != a && b != b);
+}
+
+static int close_value(double a, double b, double tolerance) {
+    return same_value(a, b) || fabs(a - b) <= tolerance * (1.0 + fabs(b));
+}
+
+static double uniform(double low, double high) {
+    return low + (high - low) * ((double)rand() / (double)RAND_MAX);
+}
+
+/* Random values with runs of one sign long enough to fill whole blocks, plus
+   zeros, signed zeros, NaN and values past the saturation bounds. */
+static void fill_inputs(double *values, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if ((i / 200) % 3 == 0) {
+            values[i] = uniform(0.01, 8.0);
+        } else if ((i / 200) % 3 == 1) {
+            values[i] = uniform(-8.0, -0.01);
+        } else {
+            values[i] = uniform(-30.0, 30.0);
+        }
+    }
+    values[3] = 0.0;
+    values[4] = -0.0;
+    values[5] = NAN;
+    values[6] = 45.0;
+    values[7] = -45.0;
+    values[250] = NAN;
+}
+
+typedef void (*unary_kernel)(const double *input_array, double *output_array, size_t array_length);
+typedef void (*strided_kernel)(const double *input_array, ptrdiff_t input_stride, double *output_array,
+                               ptrdiff_t output_stride, size_t array_length);
+
+static double elu_default(double input_value) {
+    return elu(input_value, 1.3);
+}
+
+static double elu_derivative_default(double input_value) {
+    return elu_derivative(input_value, 1.3);
+}
+
+static double leaky_derivative_default(double input_value) {
+    return leay_derivative(input_value, 0.2);
+}
+
+static void elu_kernel(const double *input_array, double *output_array, size_t array_length) {
+    elu_array(input_array, output_array, array_length, 1.3);
+}
+
+static void elu_derivative_kernel(const double *input_array, double *output_array, size_t array_length) {
+    elu_derivative_array(input_array, output_array, array_length, 1.3);
+}
+
+static void leaky_derivative_kernel(const double *input_array, double *output_array, size_t array_length) {
+    leaky_relu_derivative_array(input_array, output_array, array_length, 0.2);
+}
+
+static void elu_strided(const double *input_array, ptrdiff_t input_stride, double *output_array,
+                        ptrdiff_t output_stride, size_t array_length) {
+    elu_array_strided(input_array, input_stride, output_array, output_stride, array_length, 1.3);
+}
+
+static void elu_derivative_strided(const double *input_array, ptrdiff_t input_stride, double *output_array,
+                                   ptrdiff_t output_stride, size_t array_length) {
+    elu_derivative_array_strided(input_array, input_stride, output_array, output_stride, array_length, 1.3);
+}
+
+static void leaky_derivative_strided(const double *input_array, ptrdiff_t input_stride, double *output_array,
+                                     ptrdiff_t output_stride, size_t array_length) {
+    leaky_relu_derivative_array_strided(input_array, input_stride, output_array, output_stride, array_length, 0.2);
+}
+
+struct kernel_case {
+    const char *name;
+    activation_function scalar;
+    unary_kernel array;
+    strided_kernel strided;
+};
+
+static const struct kernel_case kernel_cases[] = {
+    {"sigmoid", sigmoid, sigmoid_array, sigmoid_array_strided},
+    {"sigmoid_derivative", sigmoid_derivative, sigmoid_derivative_array, sigmoid_derivative_array_strided},
+    {"tanh", tanh_activation, tanh_array, tanh_array_strided},
+    {"tanh_derivative", tanh_derivative, tanh_derivative_array, tanh_derivative_array_strided},
+    {"relu", relu, relu_array, relu_array_strided},
+    {"relu_derivative", relu_derivative, relu_derivative_array, relu_derivative_array_strided},
+    {"leaky_relu", leaky_relu, leaky_relu_array, leaky_relu_array_strided},
+    {"leaky_relu_derivative", leaky_derivative_default, leaky_derivative_kernel, leaky_derivative_strided},
+    {"hard_sigmoid", hard_sigmoid, hard_sigmoid_array, hard_sigmoid_array_strided},
+    {"hard_sigmoid_derivative", hard_sigmoid_derivative, hard_sigmoid_derivative_array,
+     hard_sigmoid_derivative_array_strided},
+    {"elu", elu_default, elu_kernel, elu_strided},
+    {"elu_derivative", elu_derivative_default, elu_derivative_kernel, elu_derivative_strided},
+    {"swish", swish, swish_array, swish_array_strided},
+    {"swish_derivative", swish_derivative, swish_derivative_array, swish_derivative_array_strided},
+};
+
+static void check_array_kernels(void) {
+    double input[TEST_LENGTH];
+    double output[TEST_LENGTH];
+    double in_place[TEST_LENGTH];
+    double strided_input[3 * TEST_LENGTH];
+    double strided_output[2 * TEST_LENGTH];
+    size_t c;
+    size_t i;
+    int mismatches;
+
+    fill_inputs(input, TEST_LENGTH);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        strided_input[3 * i] = input[i];
+        strided_input[3 * i + 1] = 99.0;
+        strided_input[3 * i + 2] = 99.0;
+    }
+    for (c = 0; c < sizeof(kernel_cases) / sizeof(kernel_cases[0]); c++) {
+        kernel_cases[c].array(input, output, TEST_LENGTH);
+        memcpy(in_place, input, sizeof(input));
+        kernel_cases[c].array(in_place, in_place, TEST_LENGTH);
+        kernel_cases[c].strided(strided_input, 3, strided_output, 2, TEST_LENGTH);
+        mismatches = 0;
+        for (i = 0; i < TEST_LENGTH; i++) {
+            mismatches += !same_value(output[i], kernel_cases[c].scalar(input[i]));
+            mismatches += !same_value(in_place[i], output[i]);
+            mismatches += !same_value(strided_output[2 * i], output[i]);
+        }
+        CHECK(mismatches == 0, "%s array kernels differ from the scalar in %d places", kernel_cases[c].name,
+              mismatches);
+    }
+}
+
+static void check_block_paths(void) {
+    struct block_path_stats stats;
+    double input[TEST_LENGTH];
+    double output[TEST_LENGTH];
+    size_t blocks;
+
+    fill_inputs(input, TEST_LENGTH);
+    block_path_stats_reset();
+    relu_array(input, output, TEST_LENGTH);
+    block_path_stats_get(&stats);
+    blocks = stats.positive_blocks + stats.negative_blocks + stats.mixed_blocks;
+    CHECK(blocks == TEST_LENGTH / 64, "relu_array counted %zu blocks, expected %d", blocks, TEST_LENGTH / 64);
+    CHECK(stats.positive_blocks > 0 && stats.negative_blocks > 0 && stats.mixed_blocks > 0,
+          "relu_array paths %zu/%zu/%zu, expected all three", stats.positive_blocks, stats.negative_blocks,
+          stats.mixed_blocks);
+}
+
+static void check_cached_kernels(void) {
+    struct activation_cache_stats sigmoid_stats;
+    struct activation_cache_stats tanh_stats;
+    uint64_t empty_key_bits;
+    double input[TEST_LENGTH];
+    double output[TEST_LENGTH];
+    double unique[8192];
+    double unique_output[8192];
+    int pass;
+    size_t i;
+    int mismatches;
+
+    for (i = 0; i < TEST_LENGTH; i++) {
+        input[i] = (double)(rand() % 64 - 32) / 8.0;
+    }
+    input[11] = NAN;
+    /* A NaN whose bits match the table's empty-slot marker must not hit. */
+    empty_key_bits = UINT64_C(0x7ff8dead00000000);
+    memcpy(&input[12], &empty_key_bits, sizeof(double));
+    activation_cache_reset();
+    mismatches = 0;
+    for (pass = 0; pass < 3; pass++) {
+        sigmoid_array_cached(input, output, TEST_LENGTH);
+        for (i = 0; i < TEST_LENGTH; i++) {
+            mismatches += !same_value(output[i], sigmoid(input[i]));
+        }
+        tanh_array_cached(input, output, TEST_LENGTH);
+        for (i = 0; i < TEST_LENGTH; i++) {
+            mismatches += !same_value(output[i], tanh_activation(input[i]));
+        }
+    }
+    CHECK(mismatches == 0, "cached kernels differ from the scalar in %d places", mismatches);
+
+    /* Inputs that never repeat switch off the tanh table only. */
+    for (i = 0; i < 8192; i++) {
+        unique[i] = uniform(-4.0, 4.0);
+    }
+    activation_cache_reset();
+    tanh_array_cached(unique, unique_output, 8192);
+    for (pass = 0; pass < 8; pass++) {
+        sigmoid_array_cached(input, output, TEST_LENGTH);
+    }
+    activation_cache_stats_get(&sigmoid_stats, &tanh_stats);
+    CHECK(!tanh_stats.enabled && tanh_stats.bypassed > 0, "tanh table still enabled after missing");
+    CHECK(sigmoid_stats.enabled && sigmoid_stats.bypassed == 0 && sigmoid_stats.hits > sigmoid_stats.lookups / 2,
+          "sigmoid table affected by tanh misses: %zu hits of %zu, %zu bypassed", sigmoid_stats.hits,
+          sigmoid_stats.lookups, sigmoid_stats.bypassed);
+}
+
+static void check_stats_kernels(void) {
+    struct activation_stats stats;
+    double input[TEST_LENGTH];
+    double output[TEST_LENGTH];
+    size_t relu_zeros;
+    size_t nans;
+    size_t i;
+    int mismatches;
+
+    fill_inputs(input, TEST_LENGTH);
+    memset(&stats, 0, sizeof(stats));
+    relu_array_stats(input, output, TEST_LENGTH, &stats);
+    relu_zeros = 0;
+    nans = 0;
+    mismatches = 0;
+    for (i = 0; i < TEST_LENGTH; i++) {
+        relu_zeros += relu(input[i]) == 0.0;
+        nans += input[i] != input[i];
+        mismatches += !same_value(output[i], relu(input[i]));
+    }
+    CHECK(mismatches == 0, "relu_array_stats output differs in %d places", mismatches);
+    CHECK(stats.element_count == TEST_LENGTH, "element_count %zu", stats.element_count);
+    CHECK(stats.relu_zero_count == relu_zeros, "relu_zero_count %zu, expected %zu", stats.relu_zero_count,
+          relu_zeros);
+    CHECK(stats.nan_count == nans, "nan_count %zu, expected %zu", stats.nan_count, nans);
+}
+
+static void denormal_pool_task(void *argument) {
+    double *value = argument;
+
+    swish_array(value, value, 1);
+}
+
+struct denormal_submitter {
+    struct coalescer *coalescer;
+    double value;
+};
+
+/* Leads a batch without flushing; the first batch waits out its budget. */
+static void *denormal_submit_run(void *argument) {
+    struct denormal_submitter *submitter = argument;
+    double input = 1e-310;
+
+    denormal_flush_set(0);
+    coalescer_submit(submitter->coalescer, &input, &submitter->value, 1);
+    return NULL;
+}
+
+/* swish and tanh of a denormal input are denormal, and exp(-740) is too,
+   so these read back as zero only while the kernel has flush-to-zero and
+   denormals-are-zero set; a denormal computed after the call shows that the
+   caller's MXCSR came back. */
+static void check_denormal_scope(void) {
+    struct softmax_state state;
+    volatile double tiny = 1e-300;
+    double input[2] = {1e-310, 1e-310};
+    double softmax_input[2] = {0.0, -740.0};
+    double tangent[2] = {1.0, 1.0};
+    double value[2];
+    double first[2];
+    double second[2];
+    double exp_values[2];
+    struct thread_pool *pool;
+    struct coalescer *coalescer;
+    struct denormal_submitter submitter;
+    struct timespec pause;
+    pthread_t thread;
+    void *arguments[2];
+    double pool_values[2];
+    int flush;
+
+    pool = thread_pool_create(2);
+    coalescer = coalescer_create(COALESCE_SWISH, NULL, 64, 0.0);
+    CHECK(pool != NULL && coalescer != NULL, "thread_pool_create or coalescer_create failed");
+    for (flush = 0; flush < 2; flush++) {
+        denormal_flush_set(flush);
+        swish_array_strided(input, 1, value, 1, 2);
+        CHECK((value[0] == 0.0) == flush, "swish_array_strided flush %d gave %g", flush, value[0]);
+        swish_derivatives_array(input, value, first, second, 2);
+        CHECK((value[0] == 0.0) == flush, "swish_derivatives_array flush %d gave %g", flush, value[0]);
+        swish_jvp_array(input, tangent, value, first, 2);
+        CHECK((value[0] == 0.0) == flush, "swish_jvp_array flush %d gave %g", flush, value[0]);
+        activation_cache_reset();
+        tanh_array_cached(input, value, 2);
+        CHECK((value[0] == 0.0) == flush, "tanh_array_cached flush %d gave %g", flush, value[0]);
+        softmax_incremental_init(softmax_input, exp_values, value, 2, &state);
+        CHECK((value[1] == 0.0) == flush, "softmax_incremental_init flush %d gave %g", flush, value[1]);
+        CHECK(tiny * 1e-10 != 0.0, "MXCSR not restored after flush %d", flush);
+
+        /* Pool workers and coalesced calls follow the submitting thread. */
+        pool_values[0] = 1e-310;
+        pool_values[1] = 1e-310;
+        arguments[0] = &pool_values[0];
+        arguments[1] = &pool_values[1];
+        thread_pool_run(pool, denormal_pool_task, arguments, 2);
+        CHECK((pool_values[0] == 0.0) == flush && (pool_values[1] == 0.0) == flush,
+              "thread_pool_run flush %d gave %g %g", flush, pool_values[0], pool_values[1]);
+        coalescer_submit(coalescer, input, value, 2);
+        CHECK((value[0] == 0.0) == flush, "coalescer_submit flush %d gave %g", flush, value[0]);
+    }
+    coalescer_destroy(coalescer);
+
+    /* A flushing submitter must not join a batch led by a thread that does
+       not flush. */
+    submitter.coalescer = coalescer_create(COALESCE_SWISH, NULL, 64, 0.1);
+    submitter.value = 0.0;
+    if (submitter.coalescer != NULL && pthread_create(&thread, NULL, denormal_submit_run, &submitter) == 0) {
+        pause.tv_sec = 0;
+        pause.tv_nsec = 20000000;
+        nanosleep(&pause, NULL);
+        coalescer_submit(submitter.coalescer, input, value, 1);
+        pthread_join(thread, NULL);
+        CHECK(value[0] == 0.0 && submitter.value != 0.0,
+              "mixed flush settings in one coalescer gave %g (flushing) and %g (not flushing)", value[0],
+              submitter.value);
+    }
+    coalescer_destroy(submitter.coalescer);
+    denormal_flush_set(0);
+    thread_pool_destroy(pool);
+}
+
+static double central_difference(activation_function function, double input_value) {
+    return (function(input_value + GRADIENT_STEP) - function(input_value - GRADIENT_STEP)) / (2.0 * GRADIENT_STEP);
+}
+
+static double sine_unit(double input_value) {
+    return sine_activation(input_value, 3.0);
+}
+
+static double sine_unit_derivative(double input_value) {
+    return sine_derivative(input_value, 3.0);
+}
+
+static double cosine_unit(double input_value) {
+    return cosine_activation(input_value, 3.0);
+}
+
+static double cosine_unit_derivative(double input_value) {
+    return cosine_derivative(input_value, 3.0);
+}
+
+static double elu_second_default(double input_value) {
+    return elu_second_derivative(input_value, 1.3);
+}
+
+struct derivative_case {
+    const char *name;
+    activation_function function;
+    activation_function derivative;
+};
+
+static const struct derivative_case derivative_cases[] = {
+    {"sigmoid", sigmoid, sigmoid_derivative},
+    {"tanh", tanh_activation, tanh_derivative},
+    {"relu", relu, relu_derivative},
+    {"leaky_relu", leaky_relu, NULL},
+    {"hard_sigmoid", hard_sigmoid, hard_sigmoid_derivative},
+    {"linear", linear, linear_derivative},
+    {"elu", elu_default, elu_derivative_default},
+    {"swish", swish, swish_derivative},
+    {"softplus", softplus, softplus_derivative},
+    {"gelu", gelu, gelu_derivative},
+    {"sine", sine_unit, sine_unit_derivative},
+    {"cosine", cosine_unit, cosine_unit_derivative},
+    {"sigmoid'", sigmoid_derivative, sigmoid_second_derivative},
+    {"tanh'", tanh_derivative, tanh_second_derivative},
+    {"elu'", elu_derivative_default, elu_second_default},
+    {"swish'", swish_derivative, swish_second_derivative},
+    {"softplus'", softplus_derivative, softplus_second_derivative},
+    {"gelu'", gelu_derivative, gelu_second_derivative},
+};
+
+static double leaky_relu_derivative_default(double input_value) {
+    return leay_derivative(input_value, 0.01);
+}
+
+/* Derivatives against central differences, away from the kinks at 0 and
+   +/-2.5 where the one-sided slopes differ. */
+static void check_scalar_derivatives(void) {
+    activation_function derivative;
+    double input_value;
+    double expected;
+    double worst;
+    size_t c;
+
+    for (c = 0; c < sizeof(derivative_cases) / sizeof(derivative_cases[0]); c++) {
+        derivative = derivative_cases[c].derivative != NULL ? derivative_cases[c].derivative
+                                                            : leaky_relu_derivative_default;
+        worst = 0.0;
+        for (input_value = -9.87; input_value < 10.0; input_value += 0.0731) {
+            if (fabs(input_value) < 1e-3 || fabs(fabs(input_value) - 2.5) < 1e-3) {
+                continue;
+            }
+            expected = central_difference(derivative_cases[c].function, input_value);
+            if (fabs(derivative(input_value) - expected) / (1.0 + fabs(expected)) > worst) {
+                worst = fabs(derivative(input_value) - expected) / (1.0 + fabs(expected));
+            }
+        }
+        CHECK(worst < GRADIENT_TOLERANCE, "%s derivative off by %g from central differences",
+              derivative_cases[c].name, worst);
+    }
+}
+
+static void check_fused_derivatives(void) {
+    double input[TEST_LENGTH];
+    double value[TEST_LENGTH];
+    double first[TEST_LENGTH];
+    double second[TEST_LENGTH];
+    size_t i;
+    int mismatches;
+
+    fill_inputs(input, TEST_LENGTH);
+    input[5] = 0.5;
+    input[250] = -0.5;
+
+    mismatches = 0;
+    sigmoid_derivatives_array(input, value, first, second, TEST_LENGTH);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !close_value(value[i], sigmoid(input[i]), 1e-14);
+        mismatches += !close_value(first[i], sigmoid_derivative(input[i]), 1e-14);
+        mismatches += !close_value(second[i], sigmoid_second_derivative(input[i]), 1e-12);
+    }
+    tanh_derivatives_array(input, value, first, second, TEST_LENGTH);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !close_value(value[i], tanh_activation(input[i]), 1e-14);
+        mismatches += !close_value(first[i], tanh_derivative(input[i]), 1e-14);
+        mismatches += !close_value(second[i], tanh_second_derivative(input[i]), 1e-12);
+    }
+    elu_derivatives_array(input, value, first, second, TEST_LENGTH, 1.3);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !close_value(value[i], elu(input[i], 1.3), 1e-14);
+        mismatches += !close_value(first[i], elu_derivative(input[i], 1.3), 1e-14);
+        mismatches += !close_value(second[i], elu_second_derivative(input[i], 1.3), 1e-12);
+    }
+    swish_derivatives_array(input, value, first, second, TEST_LENGTH);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !close_value(value[i], swish(input[i]), 1e-14);
+        mismatches += !close_value(first[i], swish_derivative(input[i]), 1e-14);
+        mismatches += !close_value(second[i], swish_second_derivative(input[i]), 1e-12);
+    }
+    softplus_derivatives_array(input, value, first, second, TEST_LENGTH);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !close_value(value[i], softplus(input[i]), 1e-14);
+        mismatches += !close_value(first[i], softplus_derivative(input[i]), 1e-14);
+        mismatches += !close_value(second[i], softplus_second_derivative(input[i]), 1e-12);
+    }
+    gelu_derivatives_array(input, value, first, second, TEST_LENGTH);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !close_value(value[i], gelu(input[i]), 1e-14);
+        mismatches += !close_value(first[i], gelu_derivative(input[i]), 1e-14);
+        mismatches += !close_value(second[i], gelu_second_derivative(input[i]), 1e-12);
+    }
+    CHECK(mismatches == 0, "fused derivative kernels differ from the scalars in %d places", mismatches);
+
+    sine_activation_array(input, value, first, TEST_LENGTH, 3.0);
+    mismatches = 0;
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !close_value(value[i], sine_activation(input[i], 3.0), 1e-14);
+        mismatches += !close_value(first[i], sine_derivative(input[i], 3.0), 1e-14);
+    }
+    cosine_activation_array(input, value, first, TEST_LENGTH, 3.0);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !close_value(value[i], cosine_activation(input[i], 3.0), 1e-14);
+        mismatches += !close_value(first[i], cosine_derivative(input[i], 3.0), 1e-14);
+    }
+    CHECK(mismatches == 0, "sine/cosine kernels differ from libm in %d places", mismatches);
+}
+
+typedef void (*jvp_kernel)(const double *input_array, const double *tangent_array, double *value_array,
+                           double *tangent_output_array, size_t array_length);
+
+static void elu_jvp_kernel(const double *input_array, const double *tangent_array, double *value_array,
+                           double *tangent_output_array, size_t array_length) {
+    elu_jvp_array(input_array, tangent_array, value_array, tangent_output_array, array_length, 1.3);
+}
+
+struct jvp_case {
+    const char *name;
+    jvp_kernel kernel;
+    activation_function function;
+    activation_function derivative;
+};
+
+static const struct jvp_case jvp_cases[] = {
+    {"sigmoid", sigmoid_jvp_array, sigmoid, sigmoid_derivative},
+    {"tanh", tanh_jvp_array, tanh_activation, tanh_derivative},
+    {"relu", relu_jvp_array, relu, relu_derivative},
+    {"leaky_relu", leaky_relu_jvp_array, leaky_relu, leaky_relu_derivative_default},
+    {"hard_sigmoid", hard_sigmoid_jvp_array, hard_sigmoid, hard_sigmoid_derivative},
+    {"linear", linear_jvp_array, linear, linear_derivative},
+    {"elu", elu_jvp_kernel, elu_default, elu_derivative_default},
+    {"swish", swish_jvp_array, swish, swish_derivative},
+    {"softplus", softplus_jvp_array, softplus, softplus_derivative},
+    {"gelu", gelu_jvp_array, gelu, gelu_derivative},
+};
+
+static void check_jvp_kernels(void) {
+    double input[TEST_LENGTH];
+    double tangent[TEST_LENGTH];
+    double value[TEST_LENGTH];
+    double tangent_output[TEST_LENGTH];
+    size_t c;
+    size_t i;
+    int mismatches;
+
+    fill_inputs(input, TEST_LENGTH);
+    for (i = 0; i < TEST_LENGTH; i++) {
+        tangent[i] = uniform(-2.0, 2.0);
+    }
+    for (c = 0; c < sizeof(jvp_cases) / sizeof(jvp_cases[0]); c++) {
+        jvp_cases[c].kernel(input, tangent, value, tangent_output, TEST_LENGTH);
+        mismatches = 0;
+        for (i = 0; i < TEST_LENGTH; i++) {
+            mismatches += !close_value(value[i], jvp_cases[c].function(input[i]), 1e-14);
+            mismatches += !close_value(tangent_output[i], tangent[i] * jvp_cases[c].derivative(input[i]), 1e-13);
+        }
+        CHECK(mismatches == 0, "%s_jvp_array differs from value/derivative in %d places", jvp_cases[c].name,
+              mismatches);
+    }
+}
+
+static void check_softmax(void) {
+    double input[3 * 97];
+    double output[3 * 97];
+    double rows[3 * 97];
+    double sum;
+    double max_val;
+    double worst;
+    size_t row;
+    size_t i;
+
+    for (i = 0; i < 3 * 97; i++) {
+        input[i] = uniform(-20.0, 20.0);
+    }
+    input[100] = 700.0;
+    softmax_rows(input, rows, 3, 97);
+    worst = 0.0;
+    for (row = 0; row < 3; row++) {
+        softmax(input + row * 97, output + row * 97, 97);
+        max_val = input[row * 97];
+        for (i = 1; i < 97; i++) {
+            if (input[row * 97 + i] > max_val) {
+                max_val = input[row * 97 + i];
+            }
+        }
+        sum = 0.0;
+        for (i = 0; i < 97; i++) {
+            sum += exp(input[row * 97 + i] - max_val);
+        }
+        for (i = 0; i < 97; i++) {
+            if (fabs(output[row * 97 + i] - exp(input[row * 97 + i] - max_val) / sum) > worst) {
+                worst = fabs(output[row * 97 + i] - exp(input[row * 97 + i] - max_val) / sum);
+            }
+            CHECK(same_value(rows[row * 97 + i], output[row * 97 + i]), "softmax_rows differs at %zu",
+                  row * 97 + i);
+        }
+    }
+    CHECK(worst < 1e-15, "softmax off by %g from exp / sum", worst);
+}
+
+static void check_incremental(void) {
+    double input[TEST_LENGTH];
+    double output[TEST_LENGTH];
+    double expected[TEST_LENGTH];
+    size_t dirty[16];
+    size_t i;
+    int step;
+    int mismatches;
+
+    fill_inputs(input, TEST_LENGTH);
+    swish_array(input, output, TEST_LENGTH);
+    for (step = 0; step < 50; step++) {
+        for (i = 0; i < 16; i++) {
+            dirty[i] = (size_t)rand() % TEST_LENGTH;
+            input[dirty[i]] = uniform(-5.0, 5.0);
+        }
+        activation_array_update(swish, input, output, TEST_LENGTH, dirty, 16);
+    }
+    swish_array(input, expected, TEST_LENGTH);
+    mismatches = 0;
+    for (i = 0; i < TEST_LENGTH; i++) {
+        mismatches += !same_value(output[i], expected[i]);
+    }
+    CHECK(mismatches == 0, "activation_array_update differs from a full pass in %d places", mismatches);
+}
+
+static double softmax_error(const double *input, const double *output, size_t length) {
+    double expected[256];
+    double worst;
+    size_t i;
+
+    softmax(input, expected, length);
+    worst = 0.0;
+    for (i = 0; i < length; i++) {
+        worst = fmax(worst, fabs(output[i] - expected[i]));
+    }
+    return worst;
+}
+
+static void check_softmax_incremental(void) {
+    struct softmax_state state;
+    double input[256];
+    double exp_values[256];
+    double output[256];
+    double worst;
+    size_t dirty[8];
+    size_t i;
+    int step;
+
+    /* One large input lowered a step at a time: every call keeps most of the
+       previous sum, but after 40 calls the running sum is all rounding error
+       unless it is compared with the sum of the last full pass. The sum may
+       fall to 1e-3 of its peak before a full pass, costing up to three digits. */
+    for (i = 0; i < 64; i++) {
+        input[i] = 0.0;
+    }
+    input[0] = 50.0;
+    softmax_incremental_init(input, exp_values, output, 64, &state);
+    dirty[0] = 0;
+    worst = 0.0;
+    for (step = 0; step < 40; step++) {
+        input[0] = input[0] - 1.0;
+        softmax_incremental_update(input, exp_values, output, 64, dirty, 1, &state);
+        worst = fmax(worst, softmax_error(input, output, 64));
+    }
+    CHECK(worst < 1e-10, "softmax_incremental_update off by %g after a shrinking maximum", worst);
+
+    for (i = 0; i < 256; i++) {
+        input[i] = uniform(-10.0, 10.0);
+    }
+    softmax_incremental_init(input, exp_values, output, 256, &state);
+    worst = 0.0;
+    for (step = 0; step < 500; step++) {
+        for (i = 0; i < 8; i++) {
+            dirty[i] = (size_t)rand() % 256;
+            input[dirty[i]] = uniform(-10.0, step % 50 == 0 ? 80.0 : 10.0);
+        }
+        softmax_incremental_update(input, exp_values, output, 256, dirty, 8, &state);
+        worst = fmax(worst, softmax_error(input, output, 256));
+    }
+    CHECK(worst < 1e-10, "softmax_incremental_update off by %g after random updates", worst);
+}
+
+#define COALESCE_CLIENTS 4
+#define COALESCE_SUBMISSIONS 100
+
+/* CHECK is not thread-safe, so each client only counts its mismatches. */
+struct coalesce_client {
+    struct coalescer *coalescer;
+    enum coalesce_kernel kernel;
+    size_t fixed_length;
+    unsigned int seed;
+    int mismatches;
+};
+
+static void *coalesce_client_run(void *argument) {
+    struct coalesce_client *client = argument;
+    double input[300];
+    double output[300];
+    double expected[300];
+    size_t length;
+    size_t i;
+    int submission;
+
+    for (submission = 0; submission < COALESCE_SUBMISSIONS; submission++) {
+        length = client->fixed_length != 0 ? client->fixed_length : 1 + (size_t)rand_r(&client->seed) % 300;
+        for (i = 0; i < length; i++) {
+            input[i] = -8.0 + 16.0 * ((double)rand_r(&client->seed) / (double)RAND_MAX);
+        }
+        if (client->kernel == COALESCE_SOFTMAX) {
+            softmax(input, expected, length);
+        } else {
+            sigmoid_array(input, expected, length);
+        }
+        if (submission % 10 == 0) {
+            coalescer_submit(client->coalescer, input, input, length);
+            memcpy(output, input, length * sizeof(double));
+        } else {
+            coalescer_submit(client->coalescer, input, output, length);
+        }
+        for (i = 0; i < length; i++) {
+            if (!same_value(output[i], expected[i])) {
+                client->mismatches++;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void check_coalescer(void) {
+    enum coalesce_kernel kernels[2] = {COALESCE_SIGMOID, COALESCE_SOFTMAX};
+    struct coalesce_client clients[COALESCE_CLIENTS];
+    pthread_t threads[COALESCE_CLIENTS];
+    struct coalescer_stats stats;
+    struct coalescer *coalescer;
+    struct thread_pool *pool;
+    double *input;
+    double *output;
+    double *expected;
+    size_t k;
+    size_t fixed;
+    size_t i;
+    int mismatches;
+    int c;
+
+    pool = thread_pool_create(2);
+    CHECK(pool != NULL, "thread_pool_create failed");
+    CHECK(coalescer_create(COALESCE_SIGMOID, pool, 0, 1e-4) == NULL, "coalescer_create accepted an empty batch");
+    CHECK(coalescer_create((enum coalesce_kernel)(COALESCE_SOFTMAX + 1), pool, 1024, 1e-4) == NULL &&
+              coalescer_create((enum coalesce_kernel)-1, pool, 1024, 1e-4) == NULL,
+          "coalescer_create accepted an unknown kernel");
+    for (k = 0; k < 2; k++) {
+        for (fixed = 0; fixed < 2; fixed++) {
+            /* A 2 ms budget is long enough that several clients join each
+               batch even on one core. */
+            coalescer = coalescer_create(kernels[k], pool, 1024, 2e-3);
+            CHECK(coalescer != NULL, "coalescer_create failed");
+            if (coalescer == NULL) {
+                continue;
+            }
+            for (c = 0; c < COALESCE_CLIENTS; c++) {
+                clients[c].coalescer = coalescer;
+                clients[c].kernel = kernels[k];
+                clients[c].fixed_length = fixed ? 64 : 0;
+                clients[c].seed = (unsigned int)(c + 1);
+                clients[c].mismatches = 0;
+                CHECK(pthread_create(&threads[c], NULL, coalesce_client_run, &clients[c]) == 0,
+                      "pthread_create failed");
+            }
+            mismatches = 0;
+            for (c = 0; c < COALESCE_CLIENTS; c++) {
+                pthread_join(threads[c], NULL);
+                mismatches += clients[c].mismatches;
+            }
+            CHECK(mismatches == 0, "coalescer kernel %zu fixed %zu: %d submissions differ from direct calls", k,
+                  fixed, mismatches);
+            coalescer_stats_get(coalescer, &stats);
+            CHECK(stats.submissions == COALESCE_CLIENTS * COALESCE_SUBMISSIONS, "coalescer counted %zu submissions",
+                  stats.submissions);
+            CHECK(stats.batches >= 1 && stats.batches < stats.submissions,
+                  "coalescer ran %zu batches for %zu submissions", stats.batches, stats.submissions);
+            CHECK(stats.batch_submissions_max > 1 && stats.batch_elements_max <= 1024,
+                  "coalescer batch sizes max %zu submissions, %zu elements", stats.batch_submissions_max,
+                  stats.batch_elements_max);
+            CHECK(stats.latency_p50_seconds > 0.0 && stats.latency_p50_seconds <= stats.latency_p99_seconds &&
+                      stats.latency_p99_seconds <= stats.latency_max_seconds,
+                  "coalescer latency percentiles out of order");
+            coalescer_destroy(coalescer);
+        }
+    }
+
+    /* Longer than a batch: runs alone, straight from the caller's buffers. */
+    input = malloc(40000 * sizeof(double));
+    output = malloc(40000 * sizeof(double));
+    expected = malloc(40000 * sizeof(double));
+    for (i = 0; i < 40000; i++) {
+        input[i] = uniform(-8.0, 8.0);
+    }
+    sigmoid_array(input, expected, 40000);
+    coalescer = coalescer_create(COALESCE_SIGMOID, pool, 1024, 0.0);
+    coalescer_submit(coalescer, input, output, 40000);
+    coalescer_stats_get(coalescer, &stats);
+    CHECK(memcmp(output, expected, 40000 * sizeof(double)) == 0, "oversized coalescer submission differs");
+    CHECK(stats.batches == 1 && stats.batch_elements_max == 40000, "oversized submission counted as %zu batches",
+          stats.batches);
+    coalescer_destroy(coalescer);
+
+    /* Large enough batches are split across the pool. */
+    coalescer = coalescer_create(COALESCE_SIGMOID, pool, 40000, 0.0);
+    coalescer_submit(coalescer, input, output, 40000);
+    CHECK(memcmp(output, expected, 40000 * sizeof(double)) == 0, "pool-split coalescer batch differs");
+    coalescer_destroy(coalescer);
+
+    free(input);
+    free(output);
+    free(expected);
+    thread_pool_destroy(pool);
+}
+
+#ifdef __linux__
+
+struct service_client {
+    const char *socket_path;
+    unsigned int seed;
+    int mismatches;
+    int failures;
+};
+
+/* Each client sends sigmoid rows from the front of its buffer to the middle,
+   and softmax rows in place at the back. */
+static void *service_client_run(void *argument) {
+    struct service_client *client = argument;
+    struct activation_client *connection;
+    double expected[256];
+    double *buffer;
+    size_t length;
+    size_t i;
+    int request;
+
+    connection = activation_client_connect(client->socket_path, 1024);
+    if (connection == NULL) {
+        client->failures++;
+        return NULL;
+    }
+    buffer = activation_client_buffer(connection);
+    for (request = 0; request < 50; request++) {
+        length = 1 + (size_t)rand_r(&client->seed) % 256;
+        for (i = 0; i < length; i++) {
+            buffer[i] = -8.0 + 16.0 * ((double)rand_r(&client->seed) / (double)RAND_MAX);
+            buffer[768 + i] = buffer[i];
+        }
+        sigmoid_array(buffer, expected, length);
+        client->failures += activation_client_run(connection, COALESCE_SIGMOID, 0, 256, length) != 0;
+        client->mismatches += memcmp(buffer + 256, expected, length * sizeof(double)) != 0;
+        softmax(buffer, expected, length);
+        client->failures += activation_client_run(connection, COALESCE_SOFTMAX, 768, 768, length) != 0;
+        client->mismatches += memcmp(buffer + 768, expected, length * sizeof(double)) != 0;
+    }
+    activation_client_close(connection);
+    return NULL;
+}
+
+static void check_activation_service(void) {
+    struct service_client clients[3];
+    pthread_t threads[3];
+    struct activation_service *service;
+    struct activation_service *second;
+    struct activation_client *connection;
+    struct coalescer_stats stats;
+    char socket_path[64];
+    FILE *file;
+    int mismatches;
+    int failed;
+    int c;
+
+    snprintf(socket_path, sizeof(socket_path), "/tmp/nn_check_%ld.sock", (long)getpid());
+    CHECK(activation_client_connect(socket_path, 16) == NULL, "connected with no service running");
+    service = activation_service_start(socket_path, NULL, 4096, 1e-3);
+    CHECK(service != NULL, "activation_service_start failed on %s", socket_path);
+    if (service == NULL) {
+        return;
+    }
+    second = activation_service_start(socket_path, NULL, 4096, 1e-3);
+    CHECK(second == NULL, "second service took over %s from a running one", socket_path);
+    activation_service_stop(second);
+
+    connection = activation_client_connect(socket_path, 64);
+    CHECK(connection != NULL, "activation_client_connect failed");
+    if (connection != NULL) {
+        CHECK(activation_client_run(connection, COALESCE_RELU, 0, 32, 33) == -1, "range past the buffer accepted");
+        CHECK(activation_client_run(connection, COALESCE_RELU, 0, 16, 32) == -1, "overlapping ranges accepted");
+        CHECK(activation_client_run(connection, COALESCE_RELU, (size_t)-1, 0, 2) == -1,
+              "wrapping offset accepted");
+        CHECK(activation_client_run(connection, (enum coalesce_kernel)99, 0, 32, 8) == -1,
+              "unknown kernel accepted");
+        activation_client_buffer(connection)[0] = -2.0;
+        activation_client_buffer(connection)[1] = 3.0;
+        CHECK(activation_client_run(connection, COALESCE_RELU, 0, 32, 2) == 0 &&
+                  activation_client_buffer(connection)[32] == 0.0 && activation_client_buffer(connection)[33] == 3.0,
+              "relu through the service failed after rejected requests");
+        activation_client_close(connection);
+    }
+
+    for (c = 0; c < 3; c++) {
+        clients[c].socket_path = socket_path;
+        clients[c].seed = (unsigned int)(c + 7);
+        clients[c].mismatches = 0;
+        clients[c].failures = 0;
+        CHECK(pthread_create(&threads[c], NULL, service_client_run, &clients[c]) == 0, "pthread_create failed");
+    }
+    mismatches = 0;
+    failed = 0;
+    for (c = 0; c < 3; c++) {
+        pthread_join(threads[c], NULL);
+        mismatches += clients[c].mismatches;
+        failed += clients[c].failures;
+    }
+    CHECK(failed == 0, "%d service requests failed", failed);
+    CHECK(mismatches == 0, "%d service results differ from direct calls", mismatches);
+    CHECK(activation_service_stats_get(service, COALESCE_SIGMOID, &stats) == 0 && stats.submissions == 150,
+          "service counted %zu sigmoid requests", stats.submissions);
+
+    /* Stopping disconnects clients that are still open. */
+    connection = activation_client_connect(socket_path, 16);
+    activation_service_stop(service);
+    CHECK(connection != NULL && activation_client_run(connection, COALESCE_RELU, 0, 8, 8) == -1,
+          "request succeeded after the service stopped");
+    activation_client_close(connection);
+    CHECK(access(socket_path, F_OK) != 0, "service left %s behind", socket_path);
+
+    /* A path holding another kind of file is neither replaced nor removed. */
+    file = fopen(socket_path, "w");
+    if (file != NULL) {
+        fclose(file);
+        service = activation_service_start(socket_path, NULL, 4096, 1e-3);
+        CHECK(service == NULL, "service started over the regular file %s", socket_path);
+        activation_service_stop(service);
+        CHECK(access(socket_path, F_OK) == 0, "failed start removed the regular file %s", socket_path);
+        unlink(socket_path);
+    }
+}
+
+#endif
+
+static void naive_dense(const double *weights, const double *bias, const double *input, double *pre_activation,
+                        double *output, size_t batch_size, size_t input_size, size_t output_size,
+                        activation_function activation) {
+    double sum;
+    size_t row;
+    size_t j;
+    size_t k;
+
+    for (row = 0; row < batch_size; row++) {
+        for (j = 0; j < output_size; j++) {
+            sum = bias[j];
+            for (k = 0; k < input_size; k++) {
+                sum += input[row * input_size + k] * weights[k * output_size + j];
+            }
+            pre_activation[row * output_size + j] = sum;
+            output[row * output_size + j] = activation != NULL ? activation(sum) : sum;
+        }
+    }
+}
+
+static void check_dense_forward(void) {
+    size_t shapes[5][3] = {{1, 7, 5}, {5, 33, 17}, {13, 64, 40}, {32, 300, 129}, {3, 0, 6}};
+    activation_function activations[6] = {NULL, relu, sigmoid, swish, leaky_relu, gelu};
+    double *weights;
+    double *bias;
+    double *input;
+    double *pre_activation;
+    double *output;
+    double *expected_pre;
+    double *expected;
+    double worst;
+    size_t batch;
+    size_t in;
+    size_t out;
+    size_t s;
+    size_t a;
+    size_t i;
+
+    for (s = 0; s < 5; s++) {
+        batch = shapes[s][0];
+        in = shapes[s][1];
+        out = shapes[s][2];
+        weights = malloc(in * out * sizeof(double));
+        bias = malloc(out * sizeof(double));
+        input = malloc(batch * in * sizeof(double));
+        pre_activation = malloc(batch * out * sizeof(double));
+        output = malloc(batch * out * sizeof(double));
+        expected_pre = malloc(batch * out * sizeof(double));
+        expected = malloc(batch * out * sizeof(double));
+        for (i = 0; i < in * out; i++) {
+            weights[i] = uniform(-0.5, 0.5);
+        }
+        for (i = 0; i < out; i++) {
+            bias[i] = uniform(-0.5, 0.5);
+        }
+        for (i = 0; i < batch * in; i++) {
+            input[i] = uniform(-1.0, 1.0);
+        }
+        for (a = 0; a < 6; a++) {
+            naive_dense(weights, bias, input, expected_pre, expected, batch, in, out, activations[a]);
+            dense_forward(weights, bias, input, pre_activation, output, batch, in, out, activations[a]);
+            worst = 0.0;
+            for (i = 0; i < batch * out; i++) {
+                if (fabs(pre_activation[i] - expected_pre[i]) > worst) {
+                    worst = fabs(pre_activation[i] - expected_pre[i]);
+                }
+                if (fabs(output[i] - expected[i]) > worst) {
+                    worst = fabs(output[i] - expected[i]);
+                }
+            }
+            CHECK(worst < 1e-12, "dense_forward %zux%zux%zu activation %zu off by %g", batch, in, out, a,
+                  worst);
+            dense_forward(weights, bias, input, NULL, output, batch, in, out, activations[a]);
+            worst = 0.0;
+            for (i = 0; i < batch * out; i++) {
+                if (fabs(output[i] - expected[i]) > worst) {
+                    worst = fabs(output[i] - expected[i]);
+                }
+            }
+            CHECK(worst < 1e-12, "dense_forward without pre_activation off by %g", worst);
+        }
+        free(weights);
+        free(bias);
+        free(input);
+        free(pre_activation);
+        free(output);
+        free(expected_pre);
+        free(expected);
+    }
+}
+
+/* Loss sum(output_grad * activation(input * weights + bias)) so that its
+   gradient is what dense_backward returns for that output_grad. */
+static double dense_loss(const double *weights, const double *bias, const double *input, const double *output_grad,
+                         size_t batch, size_t in, size_t out, activation_function activation) {
+    double *pre_activation;
+    double *output;
+    double loss;
+    size_t i;
+
+    pre_activation = malloc(batch * out * sizeof(double));
+    output = malloc(batch * out * sizeof(double));
+    naive_dense(weights, bias, input, pre_activation, output, batch, in, out, activation);
+    loss = 0.0;
+    for (i = 0; i < batch * out; i++) {
+        loss += output_grad[i] * output[i];
+    }
+    free(pre_activation);
+    free(output);
+    return loss;
+}
+
+static void check_dense_backward(void) {
+    size_t batch = 6;
+    size_t in = 9;
+    size_t out = 7;
+    struct thread_pool *pool;
+    double weights[9 * 7];
+    double bias[7];
+    double input[6 * 9];
+    double pre_activation[6 * 7];
+    double output[6 * 7];
+    double output_grad[6 * 7];
+    double delta[6 * 7];
+    double weight_grad[9 * 7];
+    double bias_grad[7];
+    double input_grad[6 * 9];
+    double parallel_delta[6 * 7];
+    double parallel_weight_grad[9 * 7];
+    double parallel_bias_grad[7];
+    double parallel_input_grad[6 * 9];
+    double saved;
+    double plus;
+    double minus;
+    double worst;
+    int reduction;
+    size_t i;
+
+    for (i = 0; i < in * out; i++) {
+        weights[i] = uniform(-0.5, 0.5);
+    }
+    for (i = 0; i < out; i++) {
+        bias[i] = uniform(-0.5, 0.5);
+    }
+    for (i = 0; i < batch * in; i++) {
+        input[i] = uniform(-1.0, 1.0);
+    }
+    for (i = 0; i < batch * out; i++) {
+        output_grad[i] = uniform(-1.0, 1.0);
+    }
+    naive_dense(weights, bias, input, pre_activation, output, batch, in, out, tanh_activation);
+    dense_backward(weights, input, pre_activation, output_grad, delta, weight_grad, bias_grad, input_grad, batch, in,
+                   out, tanh_derivative);
+
+    worst = 0.0;
+    for (i = 0; i < in * out; i++) {
+        saved = weights[i];
+        weights[i] = saved + GRADIENT_STEP;
+        plus = dense_loss(weights, bias, input, output_grad, batch, in, out, tanh_activation);
+        weights[i] = saved - GRADIENT_STEP;
+        minus = dense_loss(weights, bias, input, output_grad, batch, in, out, tanh_activation);
+        weights[i] = saved;
+        if (fabs(weight_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP)) > worst) {
+            worst = fabs(weight_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP));
+        }
+    }
+    for (i = 0; i < out; i++) {
+        saved = bias[i];
+        bias[i] = saved + GRADIENT_STEP;
+        plus = dense_loss(weights, bias, input, output_grad, batch, in, out, tanh_activation);
+        bias[i] = saved - GRADIENT_STEP;
+        minus = dense_loss(weights, bias, input, output_grad, batch, in, out, tanh_activation);
+        bias[i] = saved;
+        if (fabs(bias_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP)) > worst) {
+            worst = fabs(bias_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP));
+        }
+    }
+    for (i = 0; i < batch * in; i++) {
+        saved = input[i];
+        input[i] = saved + GRADIENT_STEP;
+        plus = dense_loss(weights, bias, input, output_grad, batch, in, out, tanh_activation);
+        input[i] = saved - GRADIENT_STEP;
+        minus = dense_loss(weights, bias, input, output_grad, batch, in, out, tanh_activation);
+        input[i] = saved;
+        if (fabs(input_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP)) > worst) {
+            worst = fabs(input_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP));
+        }
+    }
+    CHECK(worst < GRADIENT_TOLERANCE, "dense_backward off by %g from central differences", worst);
+
+    /* delta may alias output_grad. */
+    memcpy(parallel_delta, output_grad, sizeof(parallel_delta));
+    dense_backward(weights, input, pre_activation, parallel_delta, parallel_delta, parallel_weight_grad,
+                   parallel_bias_grad, NULL, batch, in, out, tanh_derivative);
+    worst = 0.0;
+    for (i = 0; i < batch * out; i++) {
+        worst = fmax(worst, fabs(parallel_delta[i] - delta[i]));
+    }
+    CHECK(worst == 0.0, "dense_backward with delta aliasing output_grad off by %g", worst);
+
+    pool = thread_pool_create(3);
+    CHECK(pool != NULL, "thread_pool_create failed");
+    for (reduction = 0; reduction < 2; reduction++) {
+        dense_backward_parallel(pool, (enum gradient_reduction)reduction, weights, input, pre_activation, output_grad,
+                                parallel_delta, parallel_weight_grad, parallel_bias_grad, parallel_input_grad, batch,
+                                in, out, tanh_derivative);
+        worst = 0.0;
+        for (i = 0; i < in * out; i++) {
+            worst = fmax(worst, fabs(parallel_weight_grad[i] - weight_grad[i]));
+        }
+        for (i = 0; i < out; i++) {
+            worst = fmax(worst, fabs(parallel_bias_grad[i] - bias_grad[i]));
+        }
+        for (i = 0; i < batch * in; i++) {
+            worst = fmax(worst, fabs(parallel_input_grad[i] - input_grad[i]));
+        }
+        CHECK(worst < 1e-13, "dense_backward_parallel reduction %d off by %g from serial", reduction, worst);
+    }
+
+    /* Each shard runs the batched derivative kernel on its own rows. */
+    dense_backward(weights, input, pre_activation, output_grad, delta, weight_grad, bias_grad, input_grad, batch, in,
+                   out, swish_derivative);
+    dense_backward_parallel(pool, GRADIENT_REDUCTION_TREE, weights, input, pre_activation, output_grad,
+                            parallel_delta, parallel_weight_grad, parallel_bias_grad, parallel_input_grad, batch, in,
+                            out, swish_derivative);
+    worst = 0.0;
+    for (i = 0; i < batch * out; i++) {
+        worst = fmax(worst, fabs(parallel_delta[i] - output_grad[i] * swish_derivative(pre_activation[i])));
+        worst = fmax(worst, fabs(delta[i] - output_grad[i] * swish_derivative(pre_activation[i])));
+    }
+    for (i = 0; i < in * out; i++) {
+        worst = fmax(worst, fabs(parallel_weight_grad[i] - weight_grad[i]));
+    }
+    CHECK(worst < 1e-13, "dense_backward_parallel with swish_derivative off by %g", worst);
+    thread_pool_destroy(pool);
+}
+
+static void check_mlp_forward(void) {
+    size_t sizes[4] = {5, 11, 9, 3};
+    struct dense_layer layers[3];
+    double weights[3][11 * 11];
+    double biases[3][11];
+    double input[4 * 5];
+    double output[4 * 3];
+    double pre_activation[4 * 11];
+    double hidden[2][4 * 11];
+    double *scratch;
+    double worst;
+    size_t l;
+    size_t i;
+
+    for (l = 0; l < 3; l++) {
+        for (i = 0; i < sizes[l] * sizes[l + 1]; i++) {
+            weights[l][i] = uniform(-0.5, 0.5);
+        }
+        for (i = 0; i < sizes[l + 1]; i++) {
+            biases[l][i] = uniform(-0.5, 0.5);
+        }
+        layers[l].weights = weights[l];
+        layers[l].bias = biases[l];
+        layers[l].input_size = sizes[l];
+        layers[l].output_size = sizes[l + 1];
+        layers[l].activation = l == 2 ? sigmoid : relu;
+    }
+    for (i = 0; i < 4 * 5; i++) {
+        input[i] = uniform(-1.0, 1.0);
+    }
+    scratch = malloc(mlp_scratch_length(layers, 3, 4) * sizeof(double));
+    mlp_forward(layers, 3, input, output, 4, scratch);
+    naive_dense(weights[0], biases[0], input, pre_activation, hidden[0], 4, 5, 11, relu);
+    naive_dense(weights[1], biases[1], hidden[0], pre_activation, hidden[1], 4, 11, 9, relu);
+    naive_dense(weights[2], biases[2], hidden[1], pre_activation, hidden[0], 4, 9, 3, sigmoid);
+    worst = 0.0;
+    for (i = 0; i < 4 * 3; i++) {
+        worst = fmax(worst, fabs(output[i] - hidden[0][i]));
+    }
+    CHECK(worst < 1e-13, "mlp_forward off by %g from chained layers", worst);
+    free(scratch);
+}
+
+static void check_optimizers(void) {
+    double params[5] = {0.5, -1.0, 2.0, 0.0, 3.0};
+    double grads[5] = {0.1, -0.2, 0.3, 0.0, -1.0};
+    double first[5] = {0.0};
+    double second[5] = {0.0};
+    double before[5];
+    double expected;
+    size_t i;
+    int mismatches;
+
+    sgd_update(params, grads, 5, 0.5);
+    CHECK(close_value(params[0], 0.45, 1e-15) && close_value(params[4], 3.5, 1e-15), "sgd_update gave %g %g",
+          params[0], params[4]);
+    memcpy(before, params, sizeof(params));
+    adam_update(params, grads, first, second, 5, 1, 0.01, 0.9, 0.999, 1e-8);
+    mismatches = 0;
+    for (i = 0; i < 5; i++) {
+        /* After one step the bias-corrected moments are g and g^2. */
+        expected = before[i] - 0.01 * grads[i] / (fabs(grads[i]) + 1e-8);
+        mismatches += !close_value(params[i], expected, 1e-12);
+    }
+    CHECK(mismatches == 0, "adam_update first step differs from -lr * sign(g) in %d places", mismatches);
+    memcpy(before, params, sizeof(params));
+    adam_update(params, grads, first, second, 5, 0, 0.01, 0.9, 0.999, 1e-8);
+    CHECK(memcmp(before, params, sizeof(params)) == 0, "adam_update step 0 changed the parameters");
+}
+
+static double rational_loss(const struct rational_activation *activation, const double *input,
+                            const double *output_grad, size_t length) {
+    double output[64];
+    double loss;
+    size_t i;
+
+    rational_forward(activation, input, output, length);
+    loss = 0.0;
+    for (i = 0; i < length; i++) {
+        loss += output_grad[i] * output[i];
+    }
+    return loss;
+}
+
+static void check_rational(void) {
+    double numerator[6];
+    double denominator[4];
+    double numerator_grad[6];
+    double denominator_grad[4];
+    double parallel_numerator_grad[6];
+    double parallel_denominator_grad[4];
+    double input[64];
+    double output_grad[64];
+    double input_grad[64];
+    double parallel_input_grad[64];
+    double *coefficient;
+    double analytic;
+    double saved;
+    double plus;
+    double minus;
+    double worst;
+    double fit_error;
+    struct rational_activation activation;
+    struct thread_pool *pool;
+    size_t i;
+
+    activation.numerator = numerator;
+    activation.denominator = denominator;
+    activation.numerator_degree = 5;
+    activation.denominator_degree = 4;
+    fit_error = rational_fit(&activation, tanh_activation, -4.0, 4.0);
+    CHECK(fit_error >= 0.0 && fit_error < 1e-2, "rational_fit of tanh has error %g", fit_error);
+
+    for (i = 0; i < 64; i++) {
+        input[i] = uniform(-3.0, 3.0);
+        output_grad[i] = uniform(-1.0, 1.0);
+    }
+    rational_backward(&activation, input, output_grad, input_grad, numerator_grad, denominator_grad, 64);
+    worst = 0.0;
+    for (i = 0; i < 10; i++) {
+        coefficient = i < 6 ? &numerator[i] : &denominator[i - 6];
+        analytic = i < 6 ? numerator_grad[i] : denominator_grad[i - 6];
+        saved = *coefficient;
+        *coefficient = saved + GRADIENT_STEP;
+        plus = rational_loss(&activation, input, output_grad, 64);
+        *coefficient = saved - GRADIENT_STEP;
+        minus = rational_loss(&activation, input, output_grad, 64);
+        *coefficient = saved;
+        worst = fmax(worst, fabs(analytic - (plus - minus) / (2.0 * GRADIENT_STEP)) / (1.0 + fabs(analytic)));
+    }
+    for (i = 0; i < 64; i++) {
+        saved = input[i];
+        input[i] = saved + GRADIENT_STEP;
+        plus = rational_loss(&activation, input, output_grad, 64);
+        input[i] = saved - GRADIENT_STEP;
+        minus = rational_loss(&activation, input, output_grad, 64);
+        input[i] = saved;
+        worst = fmax(worst, fabs(input_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP)));
+    }
+    CHECK(worst < GRADIENT_TOLERANCE, "rational_backward off by %g from central differences", worst);
+
+    pool = thread_pool_create(3);
+    rational_backward_parallel(pool, &activation, input, output_grad, parallel_input_grad, parallel_numerator_grad,
+                               parallel_denominator_grad, 64);
+    worst = 0.0;
+    for (i = 0; i < 6; i++) {
+        worst = fmax(worst, fabs(parallel_numerator_grad[i] - numerator_grad[i]));
+    }
+    for (i = 0; i < 4; i++) {
+        worst = fmax(worst, fabs(parallel_denominator_grad[i] - denominator_grad[i]));
+    }
+    for (i = 0; i < 64; i++) {
+        worst = fmax(worst, fabs(parallel_input_grad[i] - input_grad[i]));
+    }
+    CHECK(worst < 1e-12, "rational_backward_parallel off by %g from serial", worst);
+    thread_pool_destroy(pool);
+}
+
+static double spline_loss(const struct spline_activation *activation, const double *input, const double *output_grad,
+                          size_t length) {
+    double output[64];
+    double loss;
+    size_t i;
+
+    spline_forward(activation, input, output, length);
+    loss = 0.0;
+    for (i = 0; i < length; i++) {
+        loss += output_grad[i] * output[i];
+    }
+    return loss;
+}
+
+static void check_spline(void) {
+    enum spline_kind kinds[2] = {SPLINE_LINEAR, SPLINE_CUBIC};
+    struct spline_activation activation;
+    struct thread_pool *pool;
+    double values[12];
+    double value_grad[12];
+    double parallel_value_grad[12];
+    double input[64];
+    double output_grad[64];
+    double input_grad[64];
+    double parallel_input_grad[64];
+    double saved;
+    double plus;
+    double minus;
+    double worst;
+    size_t i;
+    int k;
+
+    pool = thread_pool_create(3);
+    for (k = 0; k < 2; k++) {
+        activation.values = values;
+        activation.value_count = 12;
+        activation.low = -3.0;
+        activation.high = 3.0;
+        activation.kind = kinds[k];
+        spline_fit(&activation, tanh_activation);
+        for (i = 0; i < 64; i++) {
+            input[i] = uniform(-3.5, 3.5);
+            output_grad[i] = uniform(-1.0, 1.0);
+        }
+        spline_backward(&activation, input, output_grad, input_grad, value_grad, 64);
+        worst = 0.0;
+        for (i = 0; i < 12; i++) {
+            saved = values[i];
+            values[i] = saved + GRADIENT_STEP;
+            plus = spline_loss(&activation, input, output_grad, 64);
+            values[i] = saved - GRADIENT_STEP;
+            minus = spline_loss(&activation, input, output_grad, 64);
+            values[i] = saved;
+            worst = fmax(worst, fabs(value_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP)));
+        }
+        /* The linear spline has kinks at the knots; only check inputs well
+           inside a segment, and the clamped region has zero slope. */
+        for (i = 0; i < 64; i++) {
+            if (kinds[k] == SPLINE_LINEAR &&
+                fabs(fmod(input[i] - activation.low, 6.0 / 11.0)) < 1e-3) {
+                continue;
+            }
+            if (fabs(fabs(input[i]) - 3.0) < 1e-3) {
+                continue;
+            }
+            saved = input[i];
+            input[i] = saved + GRADIENT_STEP;
+            plus = spline_loss(&activation, input, output_grad, 64);
+            input[i] = saved - GRADIENT_STEP;
+            minus = spline_loss(&activation, input, output_grad, 64);
+            input[i] = saved;
+            worst = fmax(worst, fabs(input_grad[i] - (plus - minus) / (2.0 * GRADIENT_STEP)));
+        }
+        CHECK(worst < GRADIENT_TOLERANCE, "spline_backward kind %d off by %g from central differences", k, worst);
+
+        spline_backward_parallel(pool, &activation, input, output_grad, parallel_input_grad, parallel_value_grad, 64);
+        worst = 0.0;
+        for (i = 0; i < 12; i++) {
+            worst = fmax(worst, fabs(parallel_value_grad[i] - value_grad[i]));
+        }
+        for (i = 0; i < 64; i++) {
+            worst = fmax(worst, fabs(parallel_input_grad[i] - input_grad[i]));
+        }
+        CHECK(worst < 1e-13, "spline_backward_parallel kind %d off by %g from serial", k, worst);
+
+        input[0] = NAN;
+        spline_forward(&activation, input, parallel_input_grad, 1);
+        spline_backward(&activation, input, output_grad, input_grad, value_grad, 1);
+        worst = 0.0;
+        for (i = 0; i < 12; i++) {
+            worst = fmax(worst, fabs(value_grad[i]));
+        }
+        CHECK(isnan(parallel_input_grad[0]) && input_grad[0] == 0.0 && worst == 0.0,
+              "spline kind %d NaN input gave output %g, input_grad %g, value_grad %g", k, parallel_input_grad[0],
+              input_grad[0], worst);
+    }
+    thread_pool_destroy(pool);
+}
+
+static void check_maxout(void) {
+    double input[40 * 5];
+    double output[40];
+    double output_grad[40];
+    double input_grad[40 * 5];
+    unsigned char argmax[40];
+    size_t group;
+    size_t piece;
+    size_t best;
+    int mismatches;
+
+    for (piece = 0; piece < 40 * 5; piece++) {
+        input[piece] = uniform(-1.0, 1.0);
+    }
+    for (group = 0; group < 40; group++) {
+        output_grad[group] = uniform(-1.0, 1.0);
+    }
+    maxout_forward(input, output, argmax, 40, 5);
+    maxout_backward(output_grad, argmax, input_grad, 40, 5);
+    mismatches = 0;
+    for (group = 0; group < 40; group++) {
+        best = 0;
+        for (piece = 1; piece < 5; piece++) {
+            if (input[group * 5 + piece] > input[group * 5 + best]) {
+                best = piece;
+            }
+        }
+        mismatches += argmax[group] != best || output[group] != input[group * 5 + best];
+        for (piece = 0; piece < 5; piece++) {
+            mismatches += input_grad[group * 5 + piece] != (piece == best ? output_grad[group] : 0.0);
+        }
+    }
+    CHECK(mismatches == 0, "maxout differs from the naive max in %d places", mismatches);
+}
+
+static void check_sparse_relu(void) {
+    size_t rows = 7;
+    size_t columns = 13;
+    double dense[7 * 13];
+    double output_grad[7 * 13];
+    double values[7 * 13];
+    double grad_values[7 * 13];
+    size_t column_indices[7 * 13];
+    size_t row_offsets[8];
+    size_t expected_count;
+    size_t count;
+    size_t row;
+    size_t k;
+    int mismatches;
+
+    expected_count = 0;
+    for (k = 0; k < rows * columns; k++) {
+        dense[k] = uniform(-1.0, 1.0);
+        output_grad[k] = uniform(-1.0, 1.0);
+        expected_count += dense[k] > 0.0;
+    }
+    count = relu_dense_to_csr(dense, rows, columns, row_offsets, column_indices, values);
+    CHECK(count == expected_count, "relu_dense_to_csr kept %zu of %zu", count, expected_count);
+    relu_backward_csr(row_offsets, column_indices, rows, columns, output_grad, grad_values);
+    mismatches = 0;
+    for (row = 0; row < rows; row++) {
+        for (k = row_offsets[row]; k < row_offsets[row + 1]; k++) {
+            mismatches += values[k] != dense[row * columns + column_indices[k]];
+            mismatches += grad_values[k] != output_grad[row * columns + column_indices[k]];
+        }
+    }
+    CHECK(mismatches == 0, "sparse relu differs from the dense matrix in %d places", mismatches);
+
+    for (k = 0; k < count; k++) {
+        values[k] = values[k] - 0.5;
+    }
+    expected_count = 0;
+    for (k = 0; k < count; k++) {
+        expected_count += values[k] > 0.0;
+    }
+    count = relu_csr(row_offsets, column_indices, values, rows);
+    CHECK(count == expected_count && row_offsets[rows] == count, "relu_csr kept %zu of %zu", count,
+          expected_count);
+}
+
+int main(void) {
+    srand(12345);
+    check_array_kernels();
+    check_block_paths();
+    check_cached_kernels();
+    check_stats_kernels();
+    check_denormal_scope();
+    check_scalar_derivatives();
+    check_fused_derivatives();
+    check_jvp_kernels();
+    check_softmax();
+    check_incremental();
+    check_softmax_incremental();
+    check_coalescer();
+#ifdef __linux__
+    check_activation_service();
+#endif
+    check_dense_forward();
+    check_dense_backward();
+    check_mlp_forward();
+    check_optimizers();
+    check_rational();
+    check_spline();
+    check_maxout();
+    check_sparse_relu();
+    printf("%d checks, %d failures\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}
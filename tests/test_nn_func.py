@@ -0,0 +1,122 @@
+import array
+import math
+import threading
+import unittest
+
+import nn_func
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+
+def sigmoid(x):
+    return 1.0 / (1.0 + math.exp(-x))
+
+
+class BufferTests(unittest.TestCase):
+    def test_array_float64(self):
+        values = array.array("d", [-3.0, -0.5, 0.0, 0.5, 3.0])
+        result = nn_func.sigmoid(values)
+        for x, y in zip(values, memoryview(result).tolist()):
+            self.assertAlmostEqual(y, sigmoid(x), places=12)
+
+    def test_in_place(self):
+        values = array.array("d", [-2.0, -1.0, 0.0, 1.0, 2.0])
+        nn_func.relu(values, out=values)
+        self.assertEqual(values.tolist(), [0.0, 0.0, 0.0, 1.0, 2.0])
+
+    def test_alpha(self):
+        values = array.array("d", [-2.0, 1.0])
+        out = array.array("d", [0.0, 0.0])
+        nn_func.elu(values, 0.5, out=out)
+        self.assertAlmostEqual(out[0], 0.5 * math.expm1(-2.0), places=12)
+        self.assertEqual(out[1], 1.0)
+
+    def test_rejects_other_formats(self):
+        with self.assertRaises(TypeError):
+            nn_func.sigmoid(array.array("i", [1, 2]))
+        with self.assertRaises(TypeError):
+            nn_func.sigmoid(array.array("d", [1.0]), out=array.array("f", [0.0]))
+        with self.assertRaises(ValueError):
+            nn_func.sigmoid(array.array("d", [1.0, 2.0]), out=array.array("d", [0.0]))
+
+
+@unittest.skipIf(numpy is None, "NumPy is not installed")
+class NumpyTests(unittest.TestCase):
+    def reference(self, x):
+        return 1.0 / (1.0 + numpy.exp(-x.astype(numpy.float64)))
+
+    def test_returns_array(self):
+        x = numpy.linspace(-6.0, 6.0, 24).reshape(2, 3, 4)
+        y = nn_func.sigmoid(x)
+        self.assertIsInstance(y, numpy.ndarray)
+        self.assertEqual(y.shape, x.shape)
+        numpy.testing.assert_allclose(y, self.reference(x), rtol=1e-12)
+
+    def test_float32(self):
+        x = numpy.linspace(-6.0, 6.0, 1500, dtype=numpy.float32)
+        y = nn_func.sigmoid(x)
+        self.assertEqual(y.dtype, numpy.float32)
+        numpy.testing.assert_allclose(y, self.reference(x), rtol=1e-6)
+
+    def test_strided_views(self):
+        for dtype in (numpy.float64, numpy.float32):
+            base = numpy.linspace(-4.0, 4.0, 200).astype(dtype).reshape(10, 20)
+            for x in (base[:, ::3], base[::-2, 1::2], base.T):
+                out = numpy.zeros((x.shape[0], 2 * x.shape[1]), dtype=dtype)[:, ::-2]
+                nn_func.tanh(x, out=out)
+                numpy.testing.assert_allclose(out, numpy.tanh(x.astype(numpy.float64)), rtol=1e-6, atol=1e-7)
+
+    def test_in_place_strided(self):
+        x = numpy.linspace(-4.0, 4.0, 64).reshape(8, 8)
+        expected = x.copy()
+        expected[:, ::2] = self.reference(x[:, ::2])
+        view = x[:, ::2]
+        nn_func.sigmoid(view, out=view)
+        numpy.testing.assert_allclose(x, expected, rtol=1e-12)
+
+    def test_overlap_rejected(self):
+        x = numpy.zeros(16)
+        with self.assertRaises(ValueError):
+            nn_func.sigmoid(x[:8], out=x[4:12])
+        with self.assertRaises(ValueError):
+            nn_func.sigmoid(x[::2], out=x[1::2])
+
+    def test_softmax(self):
+        for dtype in (numpy.float64, numpy.float32):
+            x = numpy.linspace(-3.0, 5.0, 60).astype(dtype).reshape(3, 4, 5)
+            for view in (x, x[:, ::2, ::-1], x.T):
+                y = nn_func.softmax(view)
+                expected = numpy.exp(view - view.max(axis=-1, keepdims=True))
+                expected /= expected.sum(axis=-1, keepdims=True)
+                numpy.testing.assert_allclose(y, expected, rtol=1e-6)
+        x = numpy.array([[1.0, 2.0, 3.0]])
+        nn_func.softmax(x, out=x)
+        self.assertAlmostEqual(float(x.sum()), 1.0, places=12)
+
+    def test_empty(self):
+        self.assertEqual(nn_func.sigmoid(numpy.zeros((0, 3))).shape, (0, 3))
+        self.assertEqual(nn_func.softmax(numpy.zeros((2, 0))).shape, (2, 0))
+
+    def test_threads(self):
+        x = numpy.linspace(-8.0, 8.0, 1 << 16)
+        expected = self.reference(x)
+        outputs = [numpy.empty_like(x) for _ in range(4)]
+
+        def run(out):
+            for _ in range(20):
+                nn_func.sigmoid(x, out=out)
+
+        threads = [threading.Thread(target=run, args=(out,)) for out in outputs]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for out in outputs:
+            numpy.testing.assert_allclose(out, expected, rtol=1e-12)
+
+
+if __name__ == "__main__":
+    unittest.main()